@@ -0,0 +1,357 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Batch transcoder. Decodes and renders many .cdg files in parallel, one
+ * file per task, and reports a checksum of the final frame of each file along
+ * with the overall throughput.
+ *
+ * Tasks are spread over the workers with work stealing: every worker starts
+ * with an equal share of the files, and a worker that runs out takes half of
+ * the remaining files of another worker.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h> // LONG_MAX
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h> // clock_gettime
+#include <unistd.h> // getopt, sysconf
+
+#include "cdg.h"
+#include "cdg_file.h"
+#include "cdg_convert.h"
+#include "cdg_forward.h"
+
+typedef struct {
+    const char *filename;
+    int status;       // 0 on success, 1 if decoding failed, 2 if unreadable
+    size_t packets;
+    uint64_t checksum;
+} task;
+
+/*
+ * The tasks a worker has left, packed as begin in the high and end in the low
+ * 32 bits, so that both can be updated with one compare-and-swap.
+ */
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t range;
+} queue;
+
+typedef struct {
+    int id;
+    int worker_count;
+    queue *queues;
+    task *tasks;
+    unsigned long rate; // Frames per second to render, 0 to only decode
+
+    // Reused for every task of this worker
+    cdg cdg_state;
+    unsigned char rgba[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH * 4];
+} worker;
+
+static uint64_t pack_range(uint32_t begin, uint32_t end)
+{
+    return ((uint64_t)begin << 32) | end;
+}
+
+// Takes the next task from the front of the worker's own queue
+static int queue_pop(queue *q, uint32_t *index)
+{
+    uint64_t range = atomic_load(&q->range);
+    for (;;) {
+        uint32_t begin = range >> 32;
+        uint32_t end = (uint32_t)range;
+        if (begin >= end) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak(&q->range, &range, pack_range(begin + 1, end))) {
+            *index = begin;
+            return 1;
+        }
+    }
+}
+
+// Moves the back half of the victim's tasks into the thief's empty queue
+static int queue_steal(queue *victim, queue *thief)
+{
+    uint64_t range = atomic_load(&victim->range);
+    for (;;) {
+        uint32_t begin = range >> 32;
+        uint32_t end = (uint32_t)range;
+        if (begin >= end) {
+            return 0;
+        }
+        uint32_t mid = begin + (end - begin) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &range, pack_range(begin, mid))) {
+            atomic_store(&thief->range, pack_range(mid, end));
+            return 1;
+        }
+    }
+}
+
+// FNV-1a
+static uint64_t checksum(const unsigned char *data, size_t length)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static void run_task(worker *w, task *t)
+{
+    CDG_File file;
+    if (cdg_file_open(&file, t->filename) != 0) {
+        t->status = 2;
+        return;
+    }
+
+    cdg_init(&w->cdg_state);
+    t->packets = file.count;
+    t->status = 0;
+
+    // Render at the sample points, or just decode everything in one go. Frame
+    // k shows the packets that start before k / rate seconds, counted exactly
+    // so that rates that do not divide the packet clock do not drift
+    size_t done = 0;
+    unsigned long long k = 0;
+    do {
+        size_t target = file.count;
+        if (w->rate > 0) {
+            k++;
+            unsigned long long due = (k * CDG_PACKETS_PER_SECOND + w->rate - 1) / w->rate;
+            if (due < file.count) {
+                target = due;
+            }
+        }
+        size_t n = target - done;
+        if (cdg_fast_forward(file.packets + done, n, &w->cdg_state) != n) {
+            t->status = 1;
+            break;
+        }
+        done += n;
+        cdg_convert_dirty(&w->cdg_state, CDG_FORMAT_RGBA8888, w->rgba, sizeof(w->rgba[0]));
+    } while (done < file.count);
+
+    t->checksum = checksum(&w->rgba[0][0], sizeof(w->rgba));
+    cdg_file_close(&file);
+}
+
+// Parses a whole, non-negative decimal number
+static int parse_number(const char *text, unsigned long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtoul(text, &end, 10);
+    return end == text || *end != '\0' || *text == '-' || errno != 0;
+}
+
+static void *worker_main(void *arg)
+{
+    worker *w = arg;
+    queue *own = &w->queues[w->id];
+    uint32_t index;
+
+    for (;;) {
+        while (queue_pop(own, &index)) {
+            run_task(w, &w->tasks[index]);
+        }
+
+        // Out of work, so look for someone to steal from
+        int stolen = 0;
+        for (int i = 1; i < w->worker_count && !stolen; i++) {
+            stolen = queue_steal(&w->queues[(w->id + i) % w->worker_count], own);
+        }
+        if (!stolen) {
+            return NULL;
+        }
+    }
+}
+
+// Reads file names, one per line, into a growing array
+static int read_list(FILE *list, char ***names, size_t *count, size_t *capacity)
+{
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &line_size, list)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (*count == *capacity) {
+            *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+            char **grown = realloc(*names, *capacity * sizeof(char *));
+            if (grown == NULL) {
+                free(line);
+                return -1;
+            }
+            *names = grown;
+        }
+        char *name = strdup(line);
+        if (name == NULL) {
+            free(line);
+            return -1;
+        }
+        (*names)[(*count)++] = name;
+    }
+
+    free(line);
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-r fps] [-l list] [cdg-file...]\n", program);
+    fprintf(stderr, "  -j  Number of worker threads (default: number of CPUs)\n");
+    fprintf(stderr, "  -r  Frames per second to render, at most %d, 0 to only decode (default 30)\n", CDG_PACKETS_PER_SECOND);
+    fprintf(stderr, "  -l  File with one .cdg path per line, - for stdin\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long number;
+    unsigned long rate = 30;
+    char **names = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:l:")) != -1) {
+        switch (opt) {
+            case 'j':
+                if (parse_number(optarg, &number) != 0 || number > LONG_MAX) {
+                    usage(argv[0]);
+                }
+                threads = number;
+                break;
+            case 'r':
+                // More frames than packets would only repeat frames
+                if (parse_number(optarg, &rate) != 0 || rate > CDG_PACKETS_PER_SECOND) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'l': {
+                FILE *list = strcmp(optarg, "-") == 0 ? stdin : fopen(optarg, "r");
+                if (list == NULL) {
+                    fprintf(stderr, "Error while opening list: %s\n", strerror(errno));
+                    exit(2);
+                }
+                if (read_list(list, &names, &count, &capacity) != 0) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(2);
+                }
+                if (list != stdin) {
+                    fclose(list);
+                }
+                break;
+            }
+            default:
+                usage(argv[0]);
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            names = realloc(names, capacity * sizeof(char *));
+            if (names == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(2);
+            }
+        }
+        names[count++] = argv[i];
+    }
+    if (count == 0 || threads < 1 || count > UINT32_MAX) {
+        usage(argv[0]);
+    }
+    if ((size_t)threads > count) {
+        threads = count;
+    }
+
+    task *tasks = calloc(count, sizeof(task));
+    queue *queues = aligned_alloc(64, threads * sizeof(queue));
+    worker *workers = calloc(threads, sizeof(worker));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    if (tasks == NULL || queues == NULL || workers == NULL || ids == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+
+    // Give every worker an equal, contiguous share to start with
+    for (size_t i = 0; i < count; i++) {
+        tasks[i].filename = names[i];
+    }
+    for (long i = 0; i < threads; i++) {
+        uint32_t begin = count * i / threads;
+        uint32_t end = count * (i + 1) / threads;
+        atomic_init(&queues[i].range, pack_range(begin, end));
+
+        workers[i].id = i;
+        workers[i].worker_count = threads;
+        workers[i].queues = queues;
+        workers[i].tasks = tasks;
+        workers[i].rate = rate;
+    }
+
+    double start = now();
+    for (long i = 0; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "Unable to start thread: %s\n", strerror(errno));
+            exit(2);
+        }
+    }
+    for (long i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    size_t total_packets = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *status[] = { "ok", "error", "unreadable" };
+        printf("%s %zu %016llx %s\n", status[tasks[i].status], tasks[i].packets,
+               (unsigned long long)tasks[i].checksum, tasks[i].filename);
+        total_packets += tasks[i].packets;
+        failed += tasks[i].status != 0;
+    }
+
+    fprintf(stderr, "%zu files (%zu failed), %zu packets in %.3f s with %ld threads\n",
+            count, failed, total_packets, elapsed, threads);
+    fprintf(stderr, "%.1f files/s, %.0f packets/s\n", count / elapsed, total_packets / elapsed);
+
+    return failed > 0 ? 1 : 0;
+}
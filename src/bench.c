@@ -0,0 +1,418 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmarks for the hot paths of the library: parsing, processing each kind
+ * of packet, decoding or fast-forwarding a whole song, and converting or
+ * compositing frames, all on synthetic songs so that runs are repeatable.
+ * Results are printed one JSON object per line, to be compared between
+ * builds.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h> // clock_gettime
+#include <unistd.h> // getopt
+
+#include "cdg.h"
+#include "cdg_convert.h"
+#include "cdg_compact.h"
+#include "cdg_composite.h"
+#include "cdg_forward.h"
+#include "cdg_pack.h"
+#include "cdg_timeline.h"
+#include "synth.h"
+
+// Variants of each packet to cycle through, so no one case is predicted
+#define VARIANTS 1024
+
+// Video to composite onto, with the screen scaled to its full height
+#define VIDEO_WIDTH 1920
+#define VIDEO_HEIGHT 1080
+#define VIDEO_SCALE (VIDEO_HEIGHT / CDG_SCREEN_HEIGHT)
+
+typedef struct {
+    const SubCode *packets;
+    size_t count;
+    CDG_Pack pack; // The same packets in the compact container
+    CDG_Packet *parsed;
+    cdg cdg_state;
+    CDG_Compact compact;
+    CDG_PixelFormat format;
+    unsigned char *frame;
+    CDG_YuvFrame video;
+} bench;
+
+// Runs one pass of a benchmark, returning how many operations were done
+typedef size_t (*bench_pass)(bench *b);
+
+// Keeps the compiler from dropping work whose result is never used
+static volatile unsigned int sink;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Repeats a pass for at least min_time seconds and reports the rate
+static void run(const char *name, const char *unit, bench_pass pass, bench *b, double min_time)
+{
+    // One untimed pass to warm up caches and branch predictors
+    pass(b);
+
+    size_t ops = 0;
+    double start = now();
+    double elapsed;
+    do {
+        ops += pass(b);
+        elapsed = now() - start;
+    } while (elapsed < min_time);
+
+    printf("{\"bench\": \"%s\", \"unit\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, "
+           "\"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}\n",
+           name, unit, ops, elapsed, elapsed * 1e9 / ops, ops / elapsed);
+    fflush(stdout);
+}
+
+static size_t pass_parse(bench *b)
+{
+    unsigned int types = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        CDG_Packet packet = cdg_parse_packet(&b->packets[i]);
+        types += packet.type;
+    }
+    sink = types;
+    return b->count;
+}
+
+static size_t pass_process(bench *b)
+{
+    for (size_t i = 0; i < b->count; i++) {
+        cdg_process_packet(&b->parsed[i], &b->cdg_state);
+    }
+    cdg_dirty_clear(&b->cdg_state);
+    return b->count;
+}
+
+static size_t pass_decode(bench *b)
+{
+    cdg_init(&b->cdg_state);
+    cdg_decode_range(b->packets, b->count, &b->cdg_state);
+    sink = b->cdg_state.pixels[0][0];
+    return b->count;
+}
+
+static size_t pass_forward(bench *b)
+{
+    cdg_init(&b->cdg_state);
+    cdg_fast_forward(b->packets, b->count, &b->cdg_state);
+    sink = b->cdg_state.pixels[0][0];
+    return b->count;
+}
+
+// Goes through the song in steps of one frame, like rendering video at 30 fps
+static size_t by_frames(bench *b, size_t (*decode)(const SubCode *, size_t, cdg *))
+{
+    size_t step = CDG_PACKETS_PER_SECOND / 30;
+    cdg_init(&b->cdg_state);
+    for (size_t done = 0; done < b->count; done += step) {
+        size_t n = b->count - done < step ? b->count - done : step;
+        decode(b->packets + done, n, &b->cdg_state);
+    }
+    sink = b->cdg_state.pixels[0][0];
+    return b->count;
+}
+
+static size_t pass_decode_compact(bench *b)
+{
+    cdg_compact_init(&b->compact);
+    cdg_compact_decode_range(b->packets, b->count, &b->compact);
+    sink = b->compact.pixels[0][0];
+    return b->count;
+}
+
+static size_t pass_decode_pack(bench *b)
+{
+    CDG_PackCursor cursor;
+    cdg_pack_cursor_init(&cursor, &b->pack);
+    cdg_init(&b->cdg_state);
+    cdg_pack_decode(&cursor, b->pack.count, &b->cdg_state);
+    sink = b->cdg_state.pixels[0][0];
+    return b->pack.count;
+}
+
+static size_t pass_timeline(bench *b)
+{
+    CDG_Timeline timeline;
+    cdg_timeline_build(&timeline, b->packets, b->count);
+    sink = timeline.count;
+    cdg_timeline_free(&timeline);
+    return b->count;
+}
+
+static size_t pass_decode_frames(bench *b)
+{
+    return by_frames(b, cdg_decode_range);
+}
+
+static size_t pass_forward_frames(bench *b)
+{
+    return by_frames(b, cdg_fast_forward);
+}
+
+static size_t pass_composite(bench *b)
+{
+    int x = (VIDEO_WIDTH - CDG_SCREEN_WIDTH * VIDEO_SCALE) / 2 & ~1;
+    cdg_composite(&b->cdg_state, &b->video, x, 0, VIDEO_SCALE);
+    sink = b->video.planes[0][0];
+    return 1;
+}
+
+static size_t pass_convert(bench *b)
+{
+    cdg_convert(&b->cdg_state, b->format, b->frame,
+                CDG_SCREEN_WIDTH * cdg_format_bytes_per_pixel(b->format));
+    sink = b->frame[0];
+    return 1;
+}
+
+static size_t pass_convert_compact(bench *b)
+{
+    cdg_compact_convert(&b->compact, CDG_FORMAT_RGBA8888, b->frame, CDG_SCREEN_WIDTH * 4);
+    sink = b->frame[0];
+    return 1;
+}
+
+static size_t pass_convert_indexed(bench *b)
+{
+    cdg_convert_indexed(&b->cdg_state, b->frame, CDG_SCREEN_WIDTH);
+    sink = b->frame[0];
+    return 1;
+}
+
+// What a palette animation costs with indexed output
+static size_t pass_convert_palette(bench *b)
+{
+    cdg_convert_palette(&b->cdg_state, CDG_FORMAT_RGBA8888, b->frame);
+    sink = b->frame[0];
+    return 1;
+}
+
+// Makes random packets with the given instruction, in the ranges real discs use
+static void make_packets(SubCode *packets, size_t count, unsigned char instruction, unsigned int seed)
+{
+    srand(seed);
+    for (size_t i = 0; i < count; i++) {
+        SubCode *sub = &packets[i];
+        memset(sub, 0, sizeof(*sub));
+        if (instruction == 0) {
+            continue; // Empty
+        }
+        sub->command = CDG_COMMAND;
+        sub->instruction = instruction;
+        for (int j = 0; j < 16; j++) {
+            sub->data[j] = rand() & 0x3F;
+        }
+        switch (instruction) {
+            case CDG_MEMORY_PRESET:
+                sub->data[1] = 0; // Not a repeat
+                break;
+            case CDG_TILE_BLOCK:
+            case CDG_TILE_BLOCK_XOR:
+                sub->data[2] = rand() % CDG_TILES_Y;
+                sub->data[3] = rand() % CDG_TILES_X;
+                break;
+            case CDG_SCROLL_PRESET:
+            case CDG_SCROLL_COPY:
+                sub->data[1] = (rand() % 3) << 4 | rand() % 6;
+                sub->data[2] = (rand() % 3) << 4 | rand() % 12;
+                break;
+        }
+    }
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-s seed] [-d seconds] [-t seconds] [-w cdg-file]\n", program);
+    fprintf(stderr, "  -s  Seed of the synthetic song (default 1)\n");
+    fprintf(stderr, "  -d  Length of the synthetic song (default 300)\n");
+    fprintf(stderr, "  -t  Minimum time to run each benchmark (default 0.5)\n");
+    fprintf(stderr, "  -w  Write the synthetic song to a file instead of benchmarking\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = 1;
+    unsigned long seconds = 300;
+    double min_time = 0.5;
+    const char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:t:w:")) != -1) {
+        switch (opt) {
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                min_time = strtod(optarg, NULL);
+                break;
+            case 'w':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc || seconds == 0) {
+        usage(argv[0]);
+    }
+
+    size_t count = seconds * CDG_PACKETS_PER_SECOND;
+    SubCode *song = malloc(count * sizeof(SubCode));
+    bench *b = calloc(1, sizeof(bench));
+    SubCode *variants = malloc(VARIANTS * sizeof(SubCode));
+    CDG_Packet *parsed = malloc(VARIANTS * sizeof(CDG_Packet));
+    unsigned char *frame = malloc(CDG_SCREEN_WIDTH * CDG_SCREEN_HEIGHT * 4);
+    unsigned char *video = calloc(VIDEO_WIDTH * VIDEO_HEIGHT * 3 / 2, 1);
+    if (song == NULL || b == NULL || variants == NULL || parsed == NULL || frame == NULL
+            || video == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    synth_song(song, count, seed);
+
+    if (output != NULL) {
+        FILE *file = fopen(output, "wb");
+        if (file == NULL || fwrite(song, sizeof(SubCode), count, file) != count || fclose(file) != 0) {
+            fprintf(stderr, "Error while writing file: %s\n", strerror(errno));
+            exit(2);
+        }
+        return 0;
+    }
+
+    // Parsing and decoding of the whole song
+    unsigned char *packed;
+    size_t packed_size;
+    if (cdg_pack_encode(song, count, 0, &packed, &packed_size) != 0
+            || cdg_pack_load(&b->pack, packed, packed_size) != 0) {
+        fprintf(stderr, "Packing failed: %s\n", strerror(errno));
+        exit(2);
+    }
+    b->packets = song;
+    b->count = count;
+    run("parse", "packet", pass_parse, b, min_time);
+    run("decode", "packet", pass_decode, b, min_time);
+    run("decode/pack", "packet", pass_decode_pack, b, min_time);
+    run("decode/compact", "packet", pass_decode_compact, b, min_time);
+    run("decode/30fps", "packet", pass_decode_frames, b, min_time);
+    run("forward", "packet", pass_forward, b, min_time);
+    run("forward/30fps", "packet", pass_forward_frames, b, min_time);
+    run("timeline", "packet", pass_timeline, b, min_time);
+
+    // Each kind of packet on its own, on the screen left by the song
+    static const struct {
+        const char *name;
+        unsigned char instruction;
+    } kinds[] = {
+        { "process/EMPTY",               0 },
+        { "process/MEMORY_PRESET",       CDG_MEMORY_PRESET },
+        { "process/BORDER_PRESET",       CDG_BORDER_PRESET },
+        { "process/TILE_BLOCK",          CDG_TILE_BLOCK },
+        { "process/TILE_BLOCK_XOR",      CDG_TILE_BLOCK_XOR },
+        { "process/LOAD_COLORS_LOW",     CDG_LOAD_COLORS_LOW },
+        { "process/LOAD_COLORS_HIGH",    CDG_LOAD_COLORS_HIGH },
+        { "process/SCROLL_PRESET",       CDG_SCROLL_PRESET },
+        { "process/SCROLL_COPY",         CDG_SCROLL_COPY },
+        { "process/DEFINE_TRANSPARENT",  CDG_DEFINE_TRANSPARENT },
+    };
+    cdg song_state = b->cdg_state;
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        make_packets(variants, VARIANTS, kinds[i].instruction, seed);
+        for (size_t j = 0; j < VARIANTS; j++) {
+            parsed[j] = cdg_parse_packet(&variants[j]);
+        }
+        b->parsed = parsed;
+        b->count = VARIANTS;
+        b->cdg_state = song_state;
+        run(kinds[i].name, "packet", pass_process, b, min_time);
+    }
+
+    // Conversion of whole frames, palette lookups included
+    static const struct {
+        const char *name;
+        CDG_PixelFormat format;
+    } formats[] = {
+        { "convert/RGBA8888", CDG_FORMAT_RGBA8888 },
+        { "convert/BGRA8888", CDG_FORMAT_BGRA8888 },
+        { "convert/RGB565",   CDG_FORMAT_RGB565 },
+        { "convert/RGB24",    CDG_FORMAT_RGB24 },
+    };
+    b->cdg_state = song_state;
+    b->frame = frame;
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        b->format = formats[i].format;
+        run(formats[i].name, "frame", pass_convert, b, min_time);
+    }
+    run("convert/indexed", "frame", pass_convert_indexed, b, min_time);
+    run("convert/palette", "palette", pass_convert_palette, b, min_time);
+    cdg_compact_pack(&b->cdg_state, &b->compact);
+    run("convert/compact/RGBA8888", "frame", pass_convert_compact, b, min_time);
+
+    // Compositing onto video, with the background of the song transparent
+    static const struct {
+        const char *name;
+        CDG_YuvLayout layout;
+    } layouts[] = {
+        { "composite/I420", CDG_YUV_I420 },
+        { "composite/NV12", CDG_YUV_NV12 },
+    };
+    b->cdg_state.transparent_color = 1;
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        CDG_YuvFrame *v = &b->video;
+        v->layout = layouts[i].layout;
+        v->width = VIDEO_WIDTH;
+        v->height = VIDEO_HEIGHT;
+        v->planes[0] = video;
+        v->strides[0] = VIDEO_WIDTH;
+        v->planes[1] = video + VIDEO_WIDTH * VIDEO_HEIGHT;
+        v->planes[2] = v->planes[1] + VIDEO_WIDTH * VIDEO_HEIGHT / 4;
+        v->strides[1] = v->strides[2] = VIDEO_WIDTH / 2;
+        if (v->layout == CDG_YUV_NV12) {
+            v->strides[1] = VIDEO_WIDTH;
+        }
+        run(layouts[i].name, "frame", pass_composite, b, min_time);
+    }
+
+    free(video);
+    free(frame);
+    free(packed);
+    free(parsed);
+    free(variants);
+    free(b);
+    free(song);
+    return 0;
+}
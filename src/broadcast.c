@@ -0,0 +1,301 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Frame broadcaster. Plays a .cdg file in real time and publishes its frames
+ * in shared memory, see cdg_shm.h, for other processes to display. It can
+ * also attach to a broadcast as a reader and list the frames it picks up.
+ *
+ * With -r, it starts that many reader processes of its own, each reading at
+ * a different rate. Every reader keeps its own copy of the screen, updated
+ * only where the frames say it changed, and checks it against the last frame
+ * at the end. This is a quick way to check the whole path on one machine.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h> // LONG_MAX
+#include <math.h> // isfinite
+#include <stdint.h>
+#include <time.h> // clock_gettime, nanosleep
+#include <unistd.h> // getopt, fork
+#include <sys/wait.h> // waitpid
+
+#include "cdg.h"
+#include "cdg_file.h"
+#include "cdg_player.h"
+#include "cdg_shm.h"
+
+#define DEFAULT_NAME "/cdg"
+
+// How often the publisher catches up with the clock, once per sector
+#define USECS_PER_UPDATE (1000000 / CDG_SECTORS_PER_SECOND)
+
+// How long the first reader waits between frames. Reader n waits n times as
+// long.
+#define USECS_PER_READ 4000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_usecs(long usecs)
+{
+    struct timespec ts = { usecs / 1000000, (usecs % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-n name] [-x speed] [-r readers] <cdg-file>\n", program);
+    fprintf(stderr, "       %s -a [-n name]\n", program);
+    fprintf(stderr, "  -n  Name of the shared memory (default %s)\n", DEFAULT_NAME);
+    fprintf(stderr, "  -x  Playback speed, as a factor of real time (default 1)\n");
+    fprintf(stderr, "  -r  Number of reader processes to start and check\n");
+    fprintf(stderr, "  -a  Attach to a broadcast and list its frames\n");
+    exit(1);
+}
+
+// A hash of the screen, with rows packed, and the palette, to compare
+// between processes
+// Parses a whole, non-negative decimal number
+static int parse_number(const char *text, unsigned long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtoul(text, &end, 10);
+    return end == text || *end != '\0' || *text == '-' || errno != 0;
+}
+
+// Parses a finite, positive speed such as "1" or "2.5"
+static int parse_speed(const char *text, double *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtod(text, &end);
+    return end == text || *end != '\0' || errno != 0 || !isfinite(*value) || !(*value > 0);
+}
+
+static uint64_t checksum(const unsigned char *pixels, const CDG_RGB color_table[16])
+{
+    // FNV-1a
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (int i = 0; i < CDG_SCREEN_HEIGHT * CDG_SCREEN_WIDTH; i++) {
+        hash = (hash ^ pixels[i]) * UINT64_C(1099511628211);
+    }
+    for (int i = 0; i < 16; i++) {
+        hash = (hash ^ color_table[i].red) * UINT64_C(1099511628211);
+        hash = (hash ^ color_table[i].green) * UINT64_C(1099511628211);
+        hash = (hash ^ color_table[i].blue) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/*
+ * Reads frames until the broadcast finishes. With check set, the screen is
+ * rebuilt from the changed tiles only and compared with the last frame, and
+ * the result is the exit status. Otherwise every frame is listed.
+ */
+static int run_reader(const char *name, int id, int check)
+{
+    CDG_ShmReader reader;
+    if (cdg_shm_reader_open(&reader, name) != 0) {
+        fprintf(stderr, "Error while opening %s: %s\n", name, strerror(errno));
+        return 2;
+    }
+
+    // Too large for the stack
+    static CDG_ShmFrame frame;
+    static unsigned char screen[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+    size_t frames = 0;
+
+    for (;;) {
+        // Checked first, so that the last frame is always read
+        int finished = cdg_shm_finished(&reader);
+        if (cdg_shm_read(&reader, &frame)) {
+            frames++;
+            int tiles = 0;
+            for (int row = 0; row < CDG_TILES_Y; row++) {
+                for (int column = 0; column < CDG_TILES_X; column++) {
+                    if (((frame.dirty[row] >> column) & 1) == 0) {
+                        continue;
+                    }
+                    tiles++;
+                    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+                        int y = row * CDG_TILE_HEIGHT + i;
+                        memcpy(&screen[y][column * CDG_TILE_WIDTH],
+                               &frame.pixels[y][column * CDG_TILE_WIDTH], CDG_TILE_WIDTH);
+                    }
+                }
+            }
+            if (!check) {
+                printf("%.3f s, packet %llu, %d tiles%s\n", frame.usecs / 1e6,
+                       (unsigned long long)frame.packet, tiles,
+                       frame.palette_changed ? ", new palette" : "");
+                fflush(stdout);
+            }
+        } else if (finished) {
+            break;
+        }
+        sleep_usecs((long)USECS_PER_READ * (id + 1));
+    }
+
+    int result = 0;
+    if (check) {
+        int same = memcmp(screen, frame.pixels, sizeof(screen)) == 0;
+        printf("reader %d: %zu frames, screen %016llx%s\n", id, frames,
+               (unsigned long long)checksum(screen[0], frame.color_table),
+               same ? "" : ", DIFFERS from the last frame");
+        result = same ? 0 : 1;
+    }
+
+    cdg_shm_reader_close(&reader);
+    return result;
+}
+
+// Plays the file in real time, scaled by speed, publishing every change
+static int run_publisher(CDG_ShmPublisher *publisher, CDG_File *file, double speed)
+{
+    static cdg cdg_state;
+    cdg_init(&cdg_state);
+
+    CDG_Player player;
+    cdg_player_init(&player, &cdg_state, file->packets, file->count);
+
+    // The first frame goes out right away, so readers have something to show
+    cdg_shm_publish(publisher, &cdg_state, 0, 0);
+
+    double start = now();
+    while (!cdg_player_finished(&player)) {
+        sleep_usecs(USECS_PER_UPDATE);
+
+        uint64_t usecs = (uint64_t)((now() - start) * speed * 1e6);
+        if (cdg_player_update(&player, usecs) != 0) {
+            fprintf(stderr, "Decoding failed\n");
+            return 1;
+        }
+
+        int changed = cdg_state.palette_dirty;
+        for (int i = 0; i < CDG_TILES_Y; i++) {
+            changed |= cdg_state.dirty[i] != 0;
+        }
+        if (changed) {
+            cdg_shm_publish(publisher, &cdg_state, usecs, player.position);
+        }
+    }
+
+    static unsigned char screen[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        cdg_get_row(&cdg_state, 0, y, CDG_SCREEN_WIDTH, screen[y]);
+    }
+    printf("publisher: %llu frames, screen %016llx\n",
+           (unsigned long long)atomic_load(&publisher->ring->published),
+           (unsigned long long)checksum(screen[0], cdg_state.color_table));
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = DEFAULT_NAME;
+    double speed = 1;
+    long readers = 0;
+    unsigned long number;
+    int attach = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:x:r:a")) != -1) {
+        switch (opt) {
+            case 'n':
+                name = optarg;
+                break;
+            case 'x':
+                if (parse_speed(optarg, &speed) != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'r':
+                if (parse_number(optarg, &number) != 0 || number > LONG_MAX) {
+                    usage(argv[0]);
+                }
+                readers = number;
+                break;
+            case 'a':
+                attach = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (attach) {
+        if (optind != argc) {
+            usage(argv[0]);
+        }
+        return run_reader(name, 0, 0);
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    CDG_File file;
+    if (cdg_file_open(&file, argv[optind]) != 0) {
+        fprintf(stderr, "Error while opening file: %s\n", strerror(errno));
+        exit(2);
+    }
+
+    CDG_ShmPublisher publisher;
+    if (cdg_shm_publisher_open(&publisher, name) != 0) {
+        fprintf(stderr, "Error while creating %s: %s\n", name, strerror(errno));
+        exit(2);
+    }
+
+    // Readers are started once the ring exists, so they can open it
+    fflush(stdout);
+    for (long i = 0; i < readers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Unable to start reader: %s\n", strerror(errno));
+            readers = i;
+            break;
+        }
+        if (pid == 0) {
+            exit(run_reader(name, i, 1));
+        }
+    }
+
+    int result = run_publisher(&publisher, &file, speed);
+    cdg_shm_finish(&publisher);
+
+    for (long i = 0; i < readers; i++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            result = 1;
+        }
+    }
+
+    cdg_shm_publisher_close(&publisher);
+    cdg_file_close(&file);
+    return result;
+}
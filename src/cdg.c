@@ -18,204 +18,263 @@
  */
 
 #include "cdg.h"
+#include "cdg_stats.h"
 
-#include <string.h> // memcpy
-#include <stdlib.h> // malloc, calloc
-#include <stdio.h> // printf
-#include <stdarg.h> // va_list and friends
-#include <errno.h> // errno
+#include <string.h> // memset, memcpy
 
-// Logging utilities
-int verbose = 1;
-int log_to_file = 1;
-const char *log_file = "libcdg.log";
+// All tile columns of one row in the dirty bitmap
+#define DIRTY_ROW_MASK ((UINT64_C(1) << CDG_TILES_X) - 1)
 
-// Logging function
-// TODO: Close the file, perhaps?
-int log_printf(const char *fmt, ...)
+// The bytes of a 64-bit word that hold one tile row
+#define TILE_ROW_BYTES (tile_row_mask(0x3F))
+
+/*
+ * Expansion of the 6 bits of a tile row into one byte per pixel, 0xFF where
+ * the bit is set and 0x00 where it is clear. The most significant bit is the
+ * leftmost pixel. The last two bytes are always 0.
+ */
+#define TILE_BITS(n) { \
+    (n) & 0x20 ? 0xFF : 0, (n) & 0x10 ? 0xFF : 0, (n) & 0x08 ? 0xFF : 0, \
+    (n) & 0x04 ? 0xFF : 0, (n) & 0x02 ? 0xFF : 0, (n) & 0x01 ? 0xFF : 0, 0, 0 }
+#define TILE_BITS4(n) TILE_BITS(n), TILE_BITS((n) + 1), TILE_BITS((n) + 2), TILE_BITS((n) + 3)
+#define TILE_BITS16(n) TILE_BITS4(n), TILE_BITS4((n) + 4), TILE_BITS4((n) + 8), TILE_BITS4((n) + 12)
+
+static const unsigned char tile_masks[64][8] = {
+    TILE_BITS16(0), TILE_BITS16(16), TILE_BITS16(32), TILE_BITS16(48)
+};
+
+// Returns the byte mask for one row of tile pixels
+static inline uint64_t tile_row_mask(unsigned char bits)
 {
-    if (verbose) {
-        static FILE *output = NULL;
-        if (!log_to_file && output == NULL) {
-            output = stdout;
-        } else if (log_to_file && output == NULL) {
-            output = fopen(log_file, "w");
-            if (NULL == output) {
-                fprintf(stderr, "Unable to open log file: %s\n", strerror(errno));
-            }
-        }
+    uint64_t mask;
+    memcpy(&mask, tile_masks[bits & 0x3F], sizeof(mask));
+    return mask;
+}
 
-        va_list args;
-        va_start(args, fmt);
-        vfprintf(output, fmt, args);
-        va_end(args);
+// Returns a word with every byte set to the given color
+static inline uint64_t broadcast(unsigned char color)
+{
+    return UINT64_C(0x0101010101010101) * color;
+}
+
+/*
+ * Fills a rectangle of the screen, which may wrap around the edges of the
+ * pixel matrix, with one color
+ */
+static void fill_rect(cdg *cdg_state, int x, int y, int w, int h, unsigned char color)
+{
+    int px = (x + cdg_state->origin_x) % CDG_SCREEN_WIDTH;
+    int first = w < CDG_SCREEN_WIDTH - px ? w : CDG_SCREEN_WIDTH - px;
+
+    for (int i = 0; i < h; i++) {
+        unsigned char *row = cdg_state->pixels[(y + i + cdg_state->origin_y) % CDG_SCREEN_HEIGHT];
+        memset(row + px, color, first);
+        memset(row, color, w - first);
     }
+}
 
-    return 0;
+// Marks every tile as dirty, but not the palette
+static void mark_all(cdg *cdg_state)
+{
+    for (int i = 0; i < CDG_TILES_Y; i++) {
+        cdg_state->dirty[i] = DIRTY_ROW_MASK;
+    }
 }
 
-int cdg_process_packet(CDG_Packet *packet, cdg *cdg_state)
+/*
+ * Marks the tile at the given row and column of the screen as dirty. With a
+ * fine scroll offset the tile is displayed over parts of its neighbours too.
+ */
+static void mark_tile(cdg *cdg_state, int row, int column)
+{
+    uint64_t columns = UINT64_C(1) << column;
+    if (cdg_state->offset_x != 0) {
+        columns |= UINT64_C(1) << ((column + CDG_TILES_X - 1) % CDG_TILES_X);
+    }
+
+    cdg_state->dirty[row] |= columns;
+    if (cdg_state->offset_y != 0) {
+        cdg_state->dirty[(row + CDG_TILES_Y - 1) % CDG_TILES_Y] |= columns;
+    }
+}
+
+// Moves the origin by whole tiles, wrapping around the pixel matrix
+static void move_origin(cdg *cdg_state, int tiles_x, int tiles_y)
+{
+    cdg_state->origin_x = (cdg_state->origin_x + CDG_SCREEN_WIDTH + tiles_x * CDG_TILE_WIDTH)
+                        % CDG_SCREEN_WIDTH;
+    cdg_state->origin_y = (cdg_state->origin_y + CDG_SCREEN_HEIGHT + tiles_y * CDG_TILE_HEIGHT)
+                        % CDG_SCREEN_HEIGHT;
+}
+
+void cdg_init(cdg *cdg_state)
+{
+    memset(cdg_state, 0, sizeof(*cdg_state));
+    cdg_dirty_all(cdg_state);
+}
+
+static int process_packet(CDG_Packet *packet, cdg *cdg_state)
 {
     switch(packet->type) {
         case EMPTY:
             // Do nothing, but we need to handle it for timing purposes
-            log_printf("PROCESS: Empty packet\n");
+            CDG_TRACE(cdg_state->log, "PROCESS: Empty packet");
             break;
 
         case MEMORY_PRESET: {
-            log_printf("PROCESS: Memory preset\n");
+            CDG_TRACE(cdg_state->log, "PROCESS: Memory preset");
 
-            unsigned char *color = (unsigned char *)packet->data;
+            unsigned char color = packet->data.color;
             int border_width = (CDG_SCREEN_WIDTH - CDG_VIEW_WIDTH) / 2;
             int border_height = (CDG_SCREEN_HEIGHT - CDG_VIEW_HEIGHT) / 2;
 
-            for (int i = border_width; i < CDG_SCREEN_WIDTH - border_width; i++) {
-                for (int j = border_height; j < CDG_SCREEN_HEIGHT - border_height; j++) {
-                    cdg_state->pixels[i][j] = *color;
-                }
-            }
+            fill_rect(cdg_state, border_width, border_height, CDG_VIEW_WIDTH, CDG_VIEW_HEIGHT, color);
+
+            // The view area overlaps every tile
+            mark_all(cdg_state);
             break;
         }
 
         case BORDER_PRESET: {
-            log_printf("PROCESS: Border preset\n");
+            CDG_TRACE(cdg_state->log, "PROCESS: Border preset");
 
-            unsigned char *color = (unsigned char *)packet->data;
+            unsigned char color = packet->data.color;
 
             int border_width = (CDG_SCREEN_WIDTH - CDG_VIEW_WIDTH) / 2;
             int border_height = (CDG_SCREEN_HEIGHT - CDG_VIEW_HEIGHT) / 2;
 
+            // Top and bottom borders
+            fill_rect(cdg_state, 0, 0, CDG_SCREEN_WIDTH, border_height, color);
+            fill_rect(cdg_state, 0, CDG_SCREEN_HEIGHT - border_height,
+                      CDG_SCREEN_WIDTH, border_height, color);
+
             // Left and right borders
-            for (int i = 0; i < border_width; i++) {
-                for (int j = 0; j < CDG_SCREEN_HEIGHT; j++) {
-                    cdg_state->pixels[i][j] = *color;
-                    cdg_state->pixels[CDG_SCREEN_WIDTH - i - 1][j] = *color;
-                }
+            fill_rect(cdg_state, 0, border_height, border_width, CDG_VIEW_HEIGHT, color);
+            fill_rect(cdg_state, CDG_SCREEN_WIDTH - border_width, border_height,
+                      border_width, CDG_VIEW_HEIGHT, color);
+
+            // The border lies within the outermost tiles, unless a fine
+            // scroll offset moves it further in
+            if (cdg_state->offset_x != 0 || cdg_state->offset_y != 0) {
+                mark_all(cdg_state);
+                break;
             }
-
-            // Top and bottom borders
-            for (int i = 0; i < CDG_SCREEN_WIDTH; i++) {
-                for (int j = 0; j < border_height; j++) {
-                    cdg_state->pixels[i][j] = *color;
-                    cdg_state->pixels[i][CDG_SCREEN_HEIGHT - j - 1] = *color;
-                }
+            cdg_state->dirty[0] = DIRTY_ROW_MASK;
+            cdg_state->dirty[CDG_TILES_Y - 1] = DIRTY_ROW_MASK;
+            for (int i = 1; i < CDG_TILES_Y - 1; i++) {
+                cdg_state->dirty[i] |= UINT64_C(1) | (UINT64_C(1) << (CDG_TILES_X - 1));
             }
-
             break;
         }
 
         case TILE_BLOCK:
         case TILE_BLOCK_XOR: {
             if (packet->type == TILE_BLOCK_XOR) {
-                log_printf("PROCESS: Tile block XOR\n");
+                CDG_TRACE(cdg_state->log, "PROCESS: Tile block XOR");
             } else {
-                log_printf("PROCESS: Tile block\n");
+                CDG_TRACE(cdg_state->log, "PROCESS: Tile block");
             }
 
-            CDG_Tile *tile = (CDG_Tile *)packet->data;
-            unsigned int start_row_px = tile->row * 12;
-            unsigned int start_col_px = tile->column * 6;
-
-            for(unsigned int i = 0; i < 12; i++) {
-                unsigned char byte = tile->tilePixels[i];
-                // Bitmasks for the 6 lower bits
-                unsigned char bits[6] = { 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
-                for (int j = 0; j < 6; j++) {
-                    if (0 == (byte & bits[j])) {
-                        // XOR means xor the existing color index for that pixel with color0
-                        if (packet->type == TILE_BLOCK_XOR) {
-                            unsigned char current_color = cdg_state->pixels[start_row_px + i][start_col_px + j];
-                            unsigned char xor_color = current_color ^ tile->color0;
-                            cdg_state->pixels[start_row_px + i][start_col_px + j] = xor_color;
-                        // Otherwise we just set the color index to color0
-                        } else {
-                            cdg_state->pixels[start_row_px + i][start_col_px + j] = tile->color0;
-                        }
-                    } else {
-                        // XOR means xor the existing color index for that pixel with color1
-                        if (packet->type == TILE_BLOCK_XOR) {
-                            unsigned char current_color = cdg_state->pixels[start_row_px + i][start_col_px + j];
-                            unsigned char xor_color = current_color ^ tile->color1;
-                            cdg_state->pixels[start_row_px + i][start_col_px + j] = xor_color;
-                        // Otherwise we just set the color index to color1
-                        } else {
-                            cdg_state->pixels[start_row_px + i][start_col_px + j] = tile->color1;
-                        }
-                    }
+            CDG_Tile *tile = &packet->data.tile;
+
+            // The row and column fields can address tiles outside the screen
+            if (tile->row >= CDG_TILES_Y || tile->column >= CDG_TILES_X) {
+                break;
+            }
+            mark_tile(cdg_state, tile->row, tile->column);
+
+            // The origin is on a tile boundary, so the tile does not wrap
+            unsigned int start_row_px = (tile->row * CDG_TILE_HEIGHT + cdg_state->origin_y)
+                                      % CDG_SCREEN_HEIGHT;
+            unsigned int start_col_px = (tile->column * CDG_TILE_WIDTH + cdg_state->origin_x)
+                                      % CDG_SCREEN_WIDTH;
+
+            /*
+             * A tile row is 6 pixels, so it fits in a 64-bit word. Each row
+             * is built as color0 where the mask is clear and color1 where it
+             * is set, and written with a single 8-byte load and store. The
+             * two bytes past the tile are kept as they were; the row padding
+             * makes this safe for the rightmost tile column too.
+             */
+            uint64_t color0 = broadcast(tile->color0);
+            uint64_t color1 = broadcast(tile->color1);
+
+            for (unsigned int i = 0; i < CDG_TILE_HEIGHT; i++) {
+                unsigned char *dst = &cdg_state->pixels[start_row_px + i][start_col_px];
+                uint64_t mask = tile_row_mask(tile->tilePixels[i]);
+                uint64_t row = (color0 & ~mask) | (color1 & mask);
+                uint64_t current;
+                memcpy(&current, dst, sizeof(current));
+
+                if (packet->type == TILE_BLOCK_XOR) {
+                    // XOR means xor the existing color index of each pixel
+                    current ^= row & TILE_ROW_BYTES;
+                } else {
+                    current = (current & ~TILE_ROW_BYTES) | (row & TILE_ROW_BYTES);
                 }
+                memcpy(dst, &current, sizeof(current));
             }
 
             break;
         }
 
         case LOAD_COLORS_LOW: {
-            log_printf("PROCESS: Load colors low\n");
+            CDG_TRACE(cdg_state->log, "PROCESS: Load colors low");
 
-            CDG_RGB *rgbArray = (CDG_RGB *)(packet->data);
+            CDG_RGB *rgbArray = packet->data.colors;
             for (int i = 0; i < 8; i++) {
                 cdg_state->color_table[i] = rgbArray[i];
             }
+
+            // The pixels keep their color indices
+            cdg_state->palette_dirty = 1;
             break;
         }
 
         case LOAD_COLORS_HIGH: {
-            log_printf("PROCESS: Load colors high\n");
+            CDG_TRACE(cdg_state->log, "PROCESS: Load colors high");
 
-            CDG_RGB *rgbArray = (CDG_RGB *)(packet->data);
+            CDG_RGB *rgbArray = packet->data.colors;
             for (int i = 8; i < 16; i++) {
-                cdg_state->color_table[i] = rgbArray[i];
+                cdg_state->color_table[i] = rgbArray[i - 8];
             }
+
+            // The pixels keep their color indices
+            cdg_state->palette_dirty = 1;
             break;
         }
 
+        case SCROLL_PRESET:
         case SCROLL_COPY: {
-            log_printf("PROCESS: Scroll copy\n");
-            // TODO: Handle copy-scrolling
-            break;
-        }
-        case SCROLL_PRESET: {
-            log_printf("PROCESS: Scroll preset\n");
+            if (packet->type == SCROLL_COPY) {
+                CDG_TRACE(cdg_state->log, "PROCESS: Scroll copy");
+            } else {
+                CDG_TRACE(cdg_state->log, "PROCESS: Scroll preset");
+            }
 
-            CDG_Scroll *scroll = (CDG_Scroll *)packet->data;
+            CDG_Scroll *scroll = &packet->data.scroll;
             unsigned char preset_color = scroll->color;
 
             /*
-             * Because this is the preset version, we can simply split up
-             * the scrolling into a vertical part and horizontal part when
-             * acting on it. Any blank spaces on any axis will be filled with
-             * the preset_color anyway.
+             * Scrolling moves the origin of the screen by one tile, which
+             * wraps the pixels scrolled out on one side in on the other.
+             * That is exactly what the copy version wants. The preset
+             * version then fills the strip that came in with preset_color.
              */
 
             // Horizontal scrolling is done with 6 pixels
             switch(scroll->hScroll_cmd) {
                 case SCROLL_RIGHT:
-                    // Scroll pixels to the right
-                    for(int i = 6; i < CDG_SCREEN_WIDTH; i++) {
-                        for(int j = 0; j < CDG_SCREEN_HEIGHT; j++) {
-                            cdg_state->pixels[i][j] = cdg_state->pixels[i-6][j];
-                        }
-                    }
-
-                    // Fill in the missing 6 x SCREEN_HEIGHT pixels
-                    for(int i = 0; i < 6; i++) {
-                        for(int j = 0; j < CDG_SCREEN_HEIGHT; j++) {
-                            cdg_state->pixels[i][j] = preset_color;
-                        }
+                    move_origin(cdg_state, -1, 0);
+                    if (packet->type == SCROLL_PRESET) {
+                        fill_rect(cdg_state, 0, 0, CDG_TILE_WIDTH, CDG_SCREEN_HEIGHT, preset_color);
                     }
                     break;
                 case SCROLL_LEFT:
-                    // Scroll pixels to the left
-                    for(int i = CDG_SCREEN_WIDTH - 6; i > 0; i--) {
-                        for(int j = 0; j < CDG_SCREEN_HEIGHT; j++) {
-                            cdg_state->pixels[i][j] = cdg_state->pixels[i+6][j];
-                        }
-                    }
-
-                    // Fill in the missing 6 x SCREEN_HEIGHT pixels
-                    for(int i = CDG_SCREEN_WIDTH - 6; i < CDG_SCREEN_WIDTH; i++) {
-                        for(int j = 0; j < CDG_SCREEN_HEIGHT; j++) {
-                            cdg_state->pixels[i][j] = preset_color;
-                        }
+                    move_origin(cdg_state, 1, 0);
+                    if (packet->type == SCROLL_PRESET) {
+                        fill_rect(cdg_state, CDG_SCREEN_WIDTH - CDG_TILE_WIDTH, 0,
+                                  CDG_TILE_WIDTH, CDG_SCREEN_HEIGHT, preset_color);
                     }
                     break;
                 default:
@@ -225,27 +284,45 @@ int cdg_process_packet(CDG_Packet *packet, cdg *cdg_state)
             // Vertical scrolling is done with 12 pixels
             switch(scroll->vScroll_cmd) {
                 case SCROLL_DOWN:
-                    // TODO: Implement
+                    move_origin(cdg_state, 0, -1);
+                    if (packet->type == SCROLL_PRESET) {
+                        fill_rect(cdg_state, 0, 0, CDG_SCREEN_WIDTH, CDG_TILE_HEIGHT, preset_color);
+                    }
                     break;
                 case SCROLL_UP:
-                    // TODO: Implement
+                    move_origin(cdg_state, 0, 1);
+                    if (packet->type == SCROLL_PRESET) {
+                        fill_rect(cdg_state, 0, CDG_SCREEN_HEIGHT - CDG_TILE_HEIGHT,
+                                  CDG_SCREEN_WIDTH, CDG_TILE_HEIGHT, preset_color);
+                    }
                     break;
                 default:
                     break;
             }
+
+            // The fine offsets only matter when displaying the screen
+            cdg_state->offset_x = scroll->hScroll_offset < CDG_TILE_WIDTH
+                                ? scroll->hScroll_offset : CDG_TILE_WIDTH - 1;
+            cdg_state->offset_y = scroll->vScroll_offset < CDG_TILE_HEIGHT
+                                ? scroll->vScroll_offset : CDG_TILE_HEIGHT - 1;
+
+            // Every pixel may have moved
+            mark_all(cdg_state);
             break;
         }
 
         case DEFINE_TRANSPARENT: {
-            log_printf("PROCESS: Define transparent\n");
+            CDG_TRACE(cdg_state->log, "PROCESS: Define transparent");
 
-            unsigned char *color = (unsigned char *)packet->data;
-            cdg_state->transparent_color = *color;
+            cdg_state->transparent_color = packet->data.color;
+
+            // Any pixel on the screen may now be transparent
+            cdg_state->palette_dirty = 1;
             break;
         }
 
         default:
-            log_printf("PROCESS: Invalid packet type\n");
+            CDG_ERROR(cdg_state->log, "PROCESS: Invalid packet type %d", packet->type);
 
             return 1; // This should be an error
             break;
@@ -254,7 +331,20 @@ int cdg_process_packet(CDG_Packet *packet, cdg *cdg_state)
     return 0;
 }
 
-CDG_Packet cdg_parse_packet(SubCode *sub)
+int cdg_process_packet(CDG_Packet *packet, cdg *cdg_state)
+{
+#if CDG_STATS
+    if (cdg_state->stats != NULL) {
+        uint64_t start = cdg_stats_now();
+        int result = process_packet(packet, cdg_state);
+        cdg_stats_record(cdg_state->stats, packet->type, cdg_stats_now() - start);
+        return result;
+    }
+#endif
+    return process_packet(packet, cdg_state);
+}
+
+CDG_Packet cdg_parse_packet(const SubCode *sub)
 {
     char instr;
     int i;
@@ -264,45 +354,34 @@ CDG_Packet cdg_parse_packet(SubCode *sub)
     // Even if a packet contains no data, we need it for timing purposes
     if (!cdg_contains_data(sub)) {
         packet.type = EMPTY;
-        packet.data = NULL;
+        return packet;
     }
 
     instr = cdg_get_instruction(sub);
     switch (instr) {
         case CDG_MEMORY_PRESET:
-            log_printf("INSTR: MEMORY_PRESET\n");
-
             if( (sub->data[1] & 0x0F) != 0) { // Repeat packet
                 // We treat repeat packets as empty, since we assume
                 // a realiable data stream
                 packet.type = EMPTY;
-                packet.data = NULL;
             } else {
                 packet.type = MEMORY_PRESET;
-                unsigned char color = sub->data[0] & 0x0F;
-                packet.data = malloc(sizeof(color));
-                memcpy(packet.data, &color, sizeof(color));
+                packet.data.color = sub->data[0] & 0x0F;
             }
             break;
         case CDG_BORDER_PRESET:
-            log_printf("INSTR: BORDER_PRESET\n");
-
             packet.type = BORDER_PRESET;
-            unsigned char color = sub->data[0] & 0x0F;
-            packet.data = malloc(sizeof(color));
-            memcpy(packet.data, &color, sizeof(color));
+            packet.data.color = sub->data[0] & 0x0F;
             break;
         case CDG_TILE_BLOCK:
         case CDG_TILE_BLOCK_XOR: 
             if (instr == CDG_TILE_BLOCK) {
-                log_printf("INSTR: TILE_BLOCK\n");
                 packet.type = TILE_BLOCK;
             } else {
-                log_printf("INSTR: TILE_BLOCK_XOR\n");
                 packet.type = TILE_BLOCK_XOR;
             }
 
-            CDG_Tile *tile = (CDG_Tile *)(malloc (sizeof(CDG_Tile)));
+            CDG_Tile *tile = &packet.data.tile;
             tile->color0 = sub->data[0] & 0x0F;
             tile->color1 = sub->data[1] & 0x0F;
             tile->row    = sub->data[2] & 0x1F;
@@ -312,16 +391,12 @@ CDG_Packet cdg_parse_packet(SubCode *sub)
                 // Only lower 6 bits of each byte are used
                 tile->tilePixels[i] = sub->data[i+4] & 0x3F;
             }
-
-            packet.data = tile;
             break;
         case CDG_LOAD_COLORS_LOW:
         case CDG_LOAD_COLORS_HIGH:
             if (instr == CDG_LOAD_COLORS_LOW) {
-                log_printf("INSTR: LOAD_COLORS_LOW\n");
                 packet.type = LOAD_COLORS_LOW;
             } else {
-                log_printf("INSTR: LOAD_COLORS_HIGH\n");
                 packet.type = LOAD_COLORS_HIGH;
             } 
 
@@ -331,10 +406,12 @@ CDG_Packet cdg_parse_packet(SubCode *sub)
             unsigned char blue;
 
             int array_length = 8;
-            CDG_RGB *array = calloc(array_length, sizeof(CDG_RGB));
+            CDG_RGB *array = packet.data.colors;
             for (i = 0; i < array_length; i++) {
-                // AND with 0x3F3F to clear P and Q channel
-                data = sub->data[i] & 0x3F3F;
+                // Each color is stored in two consecutive bytes. AND each
+                // with 0x3F to clear P and Q channel
+                data = ((sub->data[2 * i] & 0x3F) << 8)
+                     | (sub->data[2 * i + 1] & 0x3F);
 
                 // Parse out the red, green and blue parts and shift them down
                 // to hold the least significant bits.
@@ -360,19 +437,16 @@ CDG_Packet cdg_parse_packet(SubCode *sub)
 
                 array[i] = rgb;
             } 
-            packet.data = array;
             break;
         case CDG_SCROLL_PRESET:
         case CDG_SCROLL_COPY:
             if (instr == CDG_SCROLL_PRESET) {
-                log_printf("INSTR: SCROLL_PRESET\n");
                 packet.type = SCROLL_PRESET;
             } else {
-                log_printf("INSTR: SCROLL_COPY\n");
                 packet.type = SCROLL_COPY;
             }
 
-            CDG_Scroll *scroll = (CDG_Scroll *)(malloc (sizeof(CDG_Scroll)));
+            CDG_Scroll *scroll = &packet.data.scroll;
             scroll->color   = sub->data[0] & 0x0F;
             unsigned char hScroll = sub->data[1] & 0x3F;
             unsigned char vScroll = sub->data[2] & 0x3F;
@@ -380,44 +454,146 @@ CDG_Packet cdg_parse_packet(SubCode *sub)
             scroll->hScroll_offset = hScroll & 0x07;
             scroll->vScroll_cmd = (vScroll & 0x30) >> 4;
             scroll->vScroll_offset = vScroll & 0x0F;
-
-            packet.data = scroll;
             break;
         case CDG_DEFINE_TRANSPARENT:
-            log_printf("INSTR: DEFINE_TRANSPARENT\n");
             packet.type = DEFINE_TRANSPARENT;
-            packet.data = malloc(sizeof(sub->data[0]));
-            sub->data[0] &= 0x0F; // Only lower four bits
-            memcpy(packet.data, &sub->data[0], sizeof(sub->data[0]));
+            packet.data.color = sub->data[0] & 0x0F; // Only lower four bits
             break;
         default: 
-            log_printf("INSTR: Invalid instruction!\n");
+            // Invalid instruction
             packet.type = EMPTY;
-            packet.data = NULL;
             break;
     }
 
     return packet;
 }
 
-void cdg_packet_put(CDG_Packet *packet)
+size_t cdg_decode_range(const SubCode *subs, size_t n, cdg *cdg_state)
 {
-    if (packet->data != NULL) {
-        free(packet->data);
+    for (size_t i = 0; i < n; i++) {
+        CDG_STATS_COUNT(cdg_state->stats, packets);
+
+        // Most packets in a file are empty, so skip them before doing any
+        // parsing or dispatching
+        if ((subs[i].command & CDG_MASK) != CDG_COMMAND) {
+            CDG_STATS_COUNT(cdg_state->stats, empty);
+            continue;
+        }
+
+        CDG_Packet packet = cdg_parse_packet(&subs[i]);
+        if (packet.type == EMPTY) {
+#if CDG_STATS
+            // Parsing only gives an empty packet for repeats and garbage
+            if (cdg_get_instruction(&subs[i]) == CDG_MEMORY_PRESET) {
+                CDG_STATS_COUNT(cdg_state->stats, repeats);
+            } else {
+                CDG_STATS_COUNT(cdg_state->stats, invalid);
+            }
+#endif
+            continue;
+        }
+        if (cdg_process_packet(&packet, cdg_state) != 0) {
+            return i;
+        }
     }
+
+    return n;
+}
+
+void cdg_get_row(const cdg *cdg_state, int x, int y, int w, unsigned char *out)
+{
+    int py = (y + cdg_state->offset_y + cdg_state->origin_y) % CDG_SCREEN_HEIGHT;
+    int px = (x + cdg_state->offset_x + cdg_state->origin_x) % CDG_SCREEN_WIDTH;
+    int first = w < CDG_SCREEN_WIDTH - px ? w : CDG_SCREEN_WIDTH - px;
+
+    memcpy(out, &cdg_state->pixels[py][px], first);
+    memcpy(out + first, &cdg_state->pixels[py][0], w - first);
+}
+
+int cdg_dirty_next(cdg *cdg_state, CDG_Rect *rect)
+{
+    // Whoever did not take the palette change needs the whole screen again
+    if (cdg_state->palette_dirty) {
+        cdg_state->palette_dirty = 0;
+        mark_all(cdg_state);
+    }
+
+    // Find the first tile row with anything dirty on it
+    int row = 0;
+    while (row < CDG_TILES_Y && cdg_state->dirty[row] == 0) {
+        row++;
+    }
+    if (row == CDG_TILES_Y) {
+        return 0;
+    }
+
+    // Find the first run of dirty tiles on that row
+    uint64_t bits = cdg_state->dirty[row];
+    int first = 0;
+    while (((bits >> first) & 1) == 0) {
+        first++;
+    }
+    int last = first;
+    while (last < CDG_TILES_X && ((bits >> last) & 1) != 0) {
+        last++;
+    }
+    uint64_t run = ((UINT64_C(1) << (last - first)) - 1) << first;
+
+    // Grow the rectangle downwards as long as the rows below have the same
+    // tiles dirty, so that large updates come out as few rectangles
+    int end = row + 1;
+    while (end < CDG_TILES_Y && (cdg_state->dirty[end] & run) == run) {
+        end++;
+    }
+
+    for (int i = row; i < end; i++) {
+        cdg_state->dirty[i] &= ~run;
+    }
+
+    rect->x = first * CDG_TILE_WIDTH;
+    rect->y = row * CDG_TILE_HEIGHT;
+    rect->w = (last - first) * CDG_TILE_WIDTH;
+    rect->h = (end - row) * CDG_TILE_HEIGHT;
+
+    return 1;
+}
+
+int cdg_palette_next(cdg *cdg_state)
+{
+    int changed = cdg_state->palette_dirty;
+    cdg_state->palette_dirty = 0;
+    return changed;
+}
+
+void cdg_dirty_all(cdg *cdg_state)
+{
+    mark_all(cdg_state);
+    cdg_state->palette_dirty = 1;
+}
+
+void cdg_dirty_clear(cdg *cdg_state)
+{
+    memset(cdg_state->dirty, 0, sizeof(cdg_state->dirty));
+    cdg_state->palette_dirty = 0;
+}
+
+void cdg_packet_put(CDG_Packet *packet)
+{
+    // Packets carry their payload inline, so there is nothing to free
+    (void)packet;
 }
 
-unsigned char cdg_get_command(SubCode *sub)
+unsigned char cdg_get_command(const SubCode *sub)
 {
     return sub->command & CDG_MASK;
 }
 
-int cdg_contains_data(SubCode *sub)
+int cdg_contains_data(const SubCode *sub)
 {
     return cdg_get_command(sub) == CDG_COMMAND;
 }
 
-unsigned char cdg_get_instruction(SubCode *sub)
+unsigned char cdg_get_instruction(const SubCode *sub)
 {
     return sub->instruction & CDG_MASK;
 }
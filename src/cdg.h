@@ -25,6 +25,11 @@
 #ifndef CDG_H
 #define CDG_H
 
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#include "cdg_log.h"
+
 /**
  * Defines the content of one packet
  */
@@ -60,6 +65,8 @@
 #define CDG_PACKETS_PER_SECTOR 4
 #define CDG_SECTORS_PER_SECOND 75
 #define CDG_PACKETS_PER_SECOND (CDG_PACKETS_PER_SECTOR * CDG_SECTORS_PER_SECOND)
+// These are rounded down, use cdg_packets_before in cdg_player.h for exact
+// timing over longer spans
 #define CDG_USECS_PER_PACKET (1000000 / CDG_PACKETS_PER_SECOND)
 #define CDG_MSECS_PER_PACKET (1000 / CDG_PACKETS_PER_SECOND)
 
@@ -71,6 +78,17 @@
 #define CDG_VIEW_WIDTH 294
 #define CDG_VIEW_HEIGHT 204
 
+// Length in bytes of one row of pixels in the state, a multiple of 16
+#define CDG_SCREEN_STRIDE 304
+
+/*
+ * The screen is made up of 50x18 tiles of 6x12 pixels each
+ */
+#define CDG_TILE_WIDTH 6
+#define CDG_TILE_HEIGHT 12
+#define CDG_TILES_X (CDG_SCREEN_WIDTH / CDG_TILE_WIDTH)
+#define CDG_TILES_Y (CDG_SCREEN_HEIGHT / CDG_TILE_HEIGHT)
+
 /*
  * This represents the raw data. 24 bytes.
  */
@@ -97,11 +115,8 @@ typedef enum {
     DEFINE_TRANSPARENT
 } packet_t;
 
-// The data length is always 16 bytes, so now this is TLV without the L.
-typedef struct {
-    packet_t type;
-    void *data;
-} CDG_Packet;
+// The number of packet types above
+#define CDG_PACKET_TYPES (DEFINE_TRANSPARENT + 1)
 
 /*
  * Tile instructions set 6x12 pixels. The coloring is done binary, so that each
@@ -137,6 +152,30 @@ typedef struct {
     unsigned char blue;  // 4 bits, located in least significant bits
 } CDG_RGB;
 
+/*
+ * A parsed packet. The data length is always 16 bytes, so this is TLV without
+ * the L. The payload is stored inline, so parsing never allocates; which member
+ * of the union is valid depends on the type:
+ *
+ *   MEMORY_PRESET, BORDER_PRESET, DEFINE_TRANSPARENT -> color
+ *   TILE_BLOCK, TILE_BLOCK_XOR                       -> tile
+ *   SCROLL_PRESET, SCROLL_COPY                       -> scroll
+ *   LOAD_COLORS_LOW, LOAD_COLORS_HIGH                -> colors
+ *   EMPTY                                            -> nothing
+ */
+typedef struct {
+    packet_t type;
+    union {
+        unsigned char color;  // Only lower 4 bits are used
+        CDG_Tile      tile;
+        CDG_Scroll    scroll;
+        CDG_RGB       colors[8];
+    } data;
+} CDG_Packet;
+
+// Profiling counters, see cdg_stats.h
+typedef struct CDG_Stats CDG_Stats;
+
 /*
  * The state needed to go through a cdg file
  */
@@ -148,21 +187,83 @@ typedef struct {
     unsigned char transparent_color;
     // The pixels are not actual colors, but each unsigned
     // char in the matrix is an index to the color_table.
-    unsigned char pixels[CDG_SCREEN_WIDTH][CDG_SCREEN_HEIGHT];
+    // The matrix is row-major and rows are padded to CDG_SCREEN_STRIDE bytes;
+    // the padding holds no pixels. The screen wraps around within the
+    // matrix, so that scrolling only moves the origin: pixel (x, y) of the
+    // screen is at pixels[(y + origin_y) % HEIGHT][(x + origin_x) % WIDTH].
+    // Use cdg_get_row to read the screen as displayed.
+    unsigned char pixels[CDG_SCREEN_HEIGHT][CDG_SCREEN_STRIDE];
+    // Where the screen starts in the matrix. Always on a tile boundary.
+    int origin_x;
+    int origin_y;
+    // Fine scroll offsets, 0-5 horizontally and 0-11 vertically. The
+    // displayed screen starts this many pixels right of and below the origin.
+    int offset_x;
+    int offset_y;
+    // Tiles changed since they were last handed out by cdg_dirty_next.
+    // One word per tile row, where bit n is set if tile column n is dirty.
+    uint64_t dirty[CDG_TILES_Y];
+    // Set when the palette or the transparent color changed since it was
+    // last handed out by cdg_palette_next. Until then, cdg_dirty_next
+    // counts it as a change to the whole screen.
+    unsigned char palette_dirty;
+    // Where to log while processing packets. NULL, the default, logs nothing.
+    CDG_Log *log;
+    // Where to count processed packets when built with CDG_STATS. NULL, the
+    // default, counts nothing.
+    CDG_Stats *stats;
 } cdg;
 
+/*
+ * A rectangle on the screen, in pixels
+ */
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} CDG_Rect;
+
+// Resets the state to a black screen, with everything marked as dirty and
+// logging and counting turned off
+void cdg_init(cdg *cdg_state);
+
 // Processes a CDG packet and updates the given state accordingly
 int cdg_process_packet(CDG_Packet *packet, cdg *cdg_state);
 
 // Parses a single packet given a 24-byte SubCode
-CDG_Packet cdg_parse_packet(SubCode *sub);
+CDG_Packet cdg_parse_packet(const SubCode *sub);
+
+// Parses and processes n consecutive packets, skipping the ones that contain
+// no CD+G data. Returns the number of packets consumed, which is less than n
+// only if processing a packet failed.
+size_t cdg_decode_range(const SubCode *subs, size_t n, cdg *cdg_state);
+
+// Copies w pixels of row y of the displayed screen, starting at column x, to
+// out. Fine scroll offsets are applied, and the screen wraps around at the
+// edges. x + w must be at most CDG_SCREEN_WIDTH.
+void cdg_get_row(const cdg *cdg_state, int x, int y, int w, unsigned char *out);
+
+// Takes the next dirty rectangle out of the state and clears it. Returns 1 if
+// a rectangle was written to rect, and 0 once nothing is dirty anymore.
+int cdg_dirty_next(cdg *cdg_state, CDG_Rect *rect);
+
+// Takes a palette change out of the state. Returns 1 if the palette or the
+// transparent color changed since the last call, and 0 otherwise. Renderers
+// that draw color indices call this before cdg_dirty_next, so that a new
+// palette does not make the whole screen dirty.
+int cdg_palette_next(cdg *cdg_state);
+
+// Marks the whole screen, palette included, as dirty or clean
+void cdg_dirty_all(cdg *cdg_state);
+void cdg_dirty_clear(cdg *cdg_state);
 
-// General function to free
+// Kept for compatibility. Packets no longer own any memory, so this does nothing
 void cdg_packet_put(CDG_Packet *packet);
 
 // Auxiliary functions
-unsigned char cdg_get_command(SubCode *sub);
-int cdg_contains_data(SubCode *sub);
-unsigned char cdg_get_instruction(SubCode *sub);
+unsigned char cdg_get_command(const SubCode *sub);
+int cdg_contains_data(const SubCode *sub);
+unsigned char cdg_get_instruction(const SubCode *sub);
 
 #endif // CDG_H
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_compact.h"
+
+#include <stdint.h> // uint32_t
+#include <string.h> // memset, memcpy
+
+/*
+ * Expansion of the 6 bits of a tile row into packed pixels, 0xF where the bit
+ * is set and 0x0 where it is clear. The most significant bit is the leftmost
+ * pixel, which goes in the lower nibble of the first byte. The last byte is
+ * always 0.
+ */
+#define NIBBLE(n, bit) ((n) & (bit) ? 0x0F : 0)
+#define TILE_NIBBLES(n) { \
+    NIBBLE(n, 0x20) | NIBBLE(n, 0x10) << 4, NIBBLE(n, 0x08) | NIBBLE(n, 0x04) << 4, \
+    NIBBLE(n, 0x02) | NIBBLE(n, 0x01) << 4, 0 }
+#define TILE_NIBBLES4(n) TILE_NIBBLES(n), TILE_NIBBLES((n) + 1), TILE_NIBBLES((n) + 2), \
+                         TILE_NIBBLES((n) + 3)
+#define TILE_NIBBLES16(n) TILE_NIBBLES4(n), TILE_NIBBLES4((n) + 4), TILE_NIBBLES4((n) + 8), \
+                          TILE_NIBBLES4((n) + 12)
+
+static const unsigned char tile_masks[64][4] = {
+    TILE_NIBBLES16(0), TILE_NIBBLES16(16), TILE_NIBBLES16(32), TILE_NIBBLES16(48)
+};
+
+// The bytes of a 32-bit word that hold one tile row
+static const unsigned char tile_row_bytes[4] = { 0xFF, 0xFF, 0xFF, 0 };
+
+static inline uint32_t load32(const unsigned char *bytes)
+{
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+// Sets n pixels of a packed row, starting at pixel x, to one color
+static void fill_span(unsigned char *row, int x, int n, unsigned char color)
+{
+    if (n == 0) {
+        return;
+    }
+    if (x % 2 != 0) {
+        row[x / 2] = (row[x / 2] & 0x0F) | (color << 4);
+        x++;
+        n--;
+    }
+    memset(row + x / 2, color * 0x11, n / 2);
+    if (n % 2 != 0) {
+        int last = x + n - 1;
+        row[last / 2] = (row[last / 2] & 0xF0) | color;
+    }
+}
+
+/*
+ * Fills a rectangle of the screen, which may wrap around the edges of the
+ * pixel matrix, with one color
+ */
+static void fill_rect(CDG_Compact *compact, int x, int y, int w, int h, unsigned char color)
+{
+    int px = (x + compact->origin_x) % CDG_SCREEN_WIDTH;
+    int first = w < CDG_SCREEN_WIDTH - px ? w : CDG_SCREEN_WIDTH - px;
+
+    for (int i = 0; i < h; i++) {
+        unsigned char *row = compact->pixels[(y + i + compact->origin_y) % CDG_SCREEN_HEIGHT];
+        fill_span(row, px, first, color);
+        fill_span(row, 0, w - first, color);
+    }
+}
+
+// Moves the origin by whole tiles, see cdg.c
+static void move_origin(CDG_Compact *compact, int tiles_x, int tiles_y)
+{
+    compact->origin_x = (compact->origin_x + CDG_SCREEN_WIDTH + tiles_x * CDG_TILE_WIDTH)
+                      % CDG_SCREEN_WIDTH;
+    compact->origin_y = (compact->origin_y + CDG_SCREEN_HEIGHT + tiles_y * CDG_TILE_HEIGHT)
+                      % CDG_SCREEN_HEIGHT;
+}
+
+void cdg_compact_init(CDG_Compact *compact)
+{
+    memset(compact, 0, sizeof(*compact));
+}
+
+static void process_tile(const CDG_Packet *packet, CDG_Compact *compact)
+{
+    const CDG_Tile *tile = &packet->data.tile;
+
+    // The row and column fields can address tiles outside the screen
+    if (tile->row >= CDG_TILES_Y || tile->column >= CDG_TILES_X) {
+        return;
+    }
+
+    // The origin is on a tile boundary, so the tile does not wrap, and it
+    // starts on an even pixel, so it is three whole bytes
+    unsigned int start_row = (tile->row * CDG_TILE_HEIGHT + compact->origin_y) % CDG_SCREEN_HEIGHT;
+    unsigned int start_byte = ((tile->column * CDG_TILE_WIDTH + compact->origin_x)
+                               % CDG_SCREEN_WIDTH) / 2;
+
+    uint32_t color0 = UINT32_C(0x01010101) * (tile->color0 * 0x11);
+    uint32_t color1 = UINT32_C(0x01010101) * (tile->color1 * 0x11);
+    uint32_t row_bytes = load32(tile_row_bytes);
+
+    for (unsigned int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        unsigned char *dst = &compact->pixels[start_row + i][start_byte];
+        uint32_t mask = load32(tile_masks[tile->tilePixels[i] & 0x3F]);
+        uint32_t row = ((color0 & ~mask) | (color1 & mask)) & row_bytes;
+        uint32_t current = load32(dst);
+
+        if (packet->type == TILE_BLOCK_XOR) {
+            current ^= row;
+        } else {
+            current = (current & ~row_bytes) | row;
+        }
+        memcpy(dst, &current, sizeof(current));
+    }
+}
+
+static void process_scroll(const CDG_Packet *packet, CDG_Compact *compact)
+{
+    const CDG_Scroll *scroll = &packet->data.scroll;
+    int preset = packet->type == SCROLL_PRESET;
+
+    switch (scroll->hScroll_cmd) {
+        case SCROLL_RIGHT:
+            move_origin(compact, -1, 0);
+            if (preset) {
+                fill_rect(compact, 0, 0, CDG_TILE_WIDTH, CDG_SCREEN_HEIGHT, scroll->color);
+            }
+            break;
+        case SCROLL_LEFT:
+            move_origin(compact, 1, 0);
+            if (preset) {
+                fill_rect(compact, CDG_SCREEN_WIDTH - CDG_TILE_WIDTH, 0,
+                          CDG_TILE_WIDTH, CDG_SCREEN_HEIGHT, scroll->color);
+            }
+            break;
+        default:
+            break;
+    }
+
+    switch (scroll->vScroll_cmd) {
+        case SCROLL_DOWN:
+            move_origin(compact, 0, -1);
+            if (preset) {
+                fill_rect(compact, 0, 0, CDG_SCREEN_WIDTH, CDG_TILE_HEIGHT, scroll->color);
+            }
+            break;
+        case SCROLL_UP:
+            move_origin(compact, 0, 1);
+            if (preset) {
+                fill_rect(compact, 0, CDG_SCREEN_HEIGHT - CDG_TILE_HEIGHT,
+                          CDG_SCREEN_WIDTH, CDG_TILE_HEIGHT, scroll->color);
+            }
+            break;
+        default:
+            break;
+    }
+
+    compact->offset_x = scroll->hScroll_offset < CDG_TILE_WIDTH
+                      ? scroll->hScroll_offset : CDG_TILE_WIDTH - 1;
+    compact->offset_y = scroll->vScroll_offset < CDG_TILE_HEIGHT
+                      ? scroll->vScroll_offset : CDG_TILE_HEIGHT - 1;
+}
+
+int cdg_compact_process_packet(const CDG_Packet *packet, CDG_Compact *compact)
+{
+    int border_width = (CDG_SCREEN_WIDTH - CDG_VIEW_WIDTH) / 2;
+    int border_height = (CDG_SCREEN_HEIGHT - CDG_VIEW_HEIGHT) / 2;
+
+    switch (packet->type) {
+        case EMPTY:
+            break;
+
+        case MEMORY_PRESET:
+            fill_rect(compact, border_width, border_height, CDG_VIEW_WIDTH, CDG_VIEW_HEIGHT,
+                      packet->data.color);
+            break;
+
+        case BORDER_PRESET: {
+            unsigned char color = packet->data.color;
+            fill_rect(compact, 0, 0, CDG_SCREEN_WIDTH, border_height, color);
+            fill_rect(compact, 0, CDG_SCREEN_HEIGHT - border_height,
+                      CDG_SCREEN_WIDTH, border_height, color);
+            fill_rect(compact, 0, border_height, border_width, CDG_VIEW_HEIGHT, color);
+            fill_rect(compact, CDG_SCREEN_WIDTH - border_width, border_height,
+                      border_width, CDG_VIEW_HEIGHT, color);
+            break;
+        }
+
+        case TILE_BLOCK:
+        case TILE_BLOCK_XOR:
+            process_tile(packet, compact);
+            break;
+
+        case LOAD_COLORS_LOW:
+            memcpy(compact->color_table, packet->data.colors, 8 * sizeof(CDG_RGB));
+            break;
+
+        case LOAD_COLORS_HIGH:
+            memcpy(compact->color_table + 8, packet->data.colors, 8 * sizeof(CDG_RGB));
+            break;
+
+        case SCROLL_PRESET:
+        case SCROLL_COPY:
+            process_scroll(packet, compact);
+            break;
+
+        case DEFINE_TRANSPARENT:
+            compact->transparent_color = packet->data.color;
+            break;
+
+        default:
+            return 1;
+    }
+
+    return 0;
+}
+
+size_t cdg_compact_decode_range(const SubCode *subs, size_t n, CDG_Compact *compact)
+{
+    for (size_t i = 0; i < n; i++) {
+        if ((subs[i].command & CDG_MASK) != CDG_COMMAND) {
+            continue;
+        }
+
+        CDG_Packet packet = cdg_parse_packet(&subs[i]);
+        if (packet.type != EMPTY && cdg_compact_process_packet(&packet, compact) != 0) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+// Unpacks n pixels of a packed row, starting at pixel x
+static void unpack_span(const unsigned char *row, int x, int n, unsigned char *out)
+{
+    if (n > 0 && x % 2 != 0) {
+        *out++ = row[x / 2] >> 4;
+        x++;
+        n--;
+    }
+    const unsigned char *src = row + x / 2;
+    for (int i = 0; i < n / 2; i++) {
+        out[2 * i] = src[i] & 0x0F;
+        out[2 * i + 1] = src[i] >> 4;
+    }
+    if (n % 2 != 0) {
+        out[n - 1] = src[n / 2] & 0x0F;
+    }
+}
+
+void cdg_compact_get_row(const CDG_Compact *compact, int x, int y, int w, unsigned char *out)
+{
+    int py = (y + compact->offset_y + compact->origin_y) % CDG_SCREEN_HEIGHT;
+    int px = (x + compact->offset_x + compact->origin_x) % CDG_SCREEN_WIDTH;
+    int first = w < CDG_SCREEN_WIDTH - px ? w : CDG_SCREEN_WIDTH - px;
+
+    unpack_span(compact->pixels[py], px, first, out);
+    unpack_span(compact->pixels[py], 0, w - first, out + first);
+}
+
+void cdg_compact_pack(const cdg *cdg_state, CDG_Compact *compact)
+{
+    memcpy(compact->color_table, cdg_state->color_table, sizeof(compact->color_table));
+    compact->transparent_color = cdg_state->transparent_color;
+    compact->origin_x = cdg_state->origin_x;
+    compact->origin_y = cdg_state->origin_y;
+    compact->offset_x = cdg_state->offset_x;
+    compact->offset_y = cdg_state->offset_y;
+
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < CDG_SCREEN_WIDTH / 2; x++) {
+            compact->pixels[y][x] = (cdg_state->pixels[y][2 * x] & 0x0F)
+                                  | (cdg_state->pixels[y][2 * x + 1] << 4);
+        }
+        memset(&compact->pixels[y][CDG_SCREEN_WIDTH / 2], 0,
+               CDG_COMPACT_STRIDE - CDG_SCREEN_WIDTH / 2);
+    }
+}
+
+void cdg_compact_unpack(const CDG_Compact *compact, cdg *cdg_state)
+{
+    memcpy(cdg_state->color_table, compact->color_table, sizeof(cdg_state->color_table));
+    cdg_state->transparent_color = compact->transparent_color;
+    cdg_state->origin_x = compact->origin_x;
+    cdg_state->origin_y = compact->origin_y;
+    cdg_state->offset_x = compact->offset_x;
+    cdg_state->offset_y = compact->offset_y;
+
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        unpack_span(compact->pixels[y], 0, CDG_SCREEN_WIDTH, cdg_state->pixels[y]);
+    }
+
+    cdg_dirty_all(cdg_state);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A compact decoder state, for keeping many songs decoded at once. Pixels are
+ * packed two to a byte, which halves the size of the state, the most a 4-bit
+ * color index allows. Packets are processed directly on the packed pixels: a
+ * tile row is three bytes, so it is written with one masked 32-bit store, and
+ * presets are byte fills.
+ *
+ * There is no dirty tracking, logging or counting. Convert whole frames with
+ * the functions in cdg_convert.h, or unpack to a full state to draw changes
+ * only.
+ */
+
+#ifndef CDG_COMPACT_H
+#define CDG_COMPACT_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+// Length in bytes of one row of packed pixels. The padding leaves room for
+// the 32-bit store of the rightmost tile.
+#define CDG_COMPACT_STRIDE 152
+
+/*
+ * The same state as cdg, with the pixels packed like in CDG_Snapshot: laid
+ * out as in the full state, wrapped around the origin, with the left pixel
+ * of each pair in the lower nibble.
+ */
+typedef struct {
+    CDG_RGB color_table[16];
+    unsigned char transparent_color;
+    unsigned char pixels[CDG_SCREEN_HEIGHT][CDG_COMPACT_STRIDE];
+    int origin_x;
+    int origin_y;
+    int offset_x;
+    int offset_y;
+} CDG_Compact;
+
+// Resets the state to a black screen
+void cdg_compact_init(CDG_Compact *compact);
+
+// Processes a packet, see cdg_process_packet
+int cdg_compact_process_packet(const CDG_Packet *packet, CDG_Compact *compact);
+
+// Parses and processes n consecutive packets, see cdg_decode_range
+size_t cdg_compact_decode_range(const SubCode *subs, size_t n, CDG_Compact *compact);
+
+// Copies w color indices of row y of the displayed screen, starting at column
+// x, to out, one byte each. See cdg_get_row.
+void cdg_compact_get_row(const CDG_Compact *compact, int x, int y, int w, unsigned char *out);
+
+// Packs a full state. Its dirty rectangles, log and statistics are not kept.
+void cdg_compact_pack(const cdg *cdg_state, CDG_Compact *compact);
+
+// Unpacks into a full state and marks it all as dirty. The log and
+// statistics of the state are left as they are.
+void cdg_compact_unpack(const CDG_Compact *compact, cdg *cdg_state);
+
+#endif // CDG_COMPACT_H
@@ -0,0 +1,367 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_composite.h"
+
+#include <string.h> // memcpy, memset
+
+#ifdef __SSSE3__
+#include <tmmintrin.h> // _mm_shuffle_epi8
+#endif
+
+// The widest part of a frame one screen row can cover, with room for rounding
+// out to whole chroma samples and for the 16-byte loads
+#define ROW_LENGTH (CDG_SCREEN_WIDTH * CDG_COMPOSITE_MAX_SCALE + 2 + 16)
+
+/*
+ * The palette in YUV. Pixels of the transparent color, and everywhere around
+ * the screen, are marked with the transparent index so that one comparison
+ * finds both.
+ */
+typedef struct {
+    unsigned char y[16];
+    int u[16];
+    int v[16];
+    unsigned char transparent;
+} yuv_palette;
+
+// Where the screen goes on the frame
+typedef struct {
+    int x;
+    int y;
+    int scale;
+} placement;
+
+// A part of the frame, made of whole chroma samples
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} region;
+
+static void build_palette(const cdg *cdg_state, yuv_palette *pal)
+{
+    for (int i = 0; i < 16; i++) {
+        int r = (cdg_state->color_table[i].red & 0x0F) * 0x11;
+        int g = (cdg_state->color_table[i].green & 0x0F) * 0x11;
+        int b = (cdg_state->color_table[i].blue & 0x0F) * 0x11;
+        pal->y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        pal->u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        pal->v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+    pal->transparent = cdg_state->transparent_color & 0x0F;
+}
+
+static int valid_frame(const CDG_YuvFrame *frame)
+{
+    if (frame->width <= 0 || frame->height <= 0 || frame->width % 2 != 0 || frame->height % 2 != 0
+            || frame->planes[0] == NULL || frame->planes[1] == NULL) {
+        return 0;
+    }
+    switch (frame->layout) {
+        case CDG_YUV_I420:
+            return frame->planes[2] != NULL;
+        case CDG_YUV_NV12:
+            return 1;
+    }
+    return 0;
+}
+
+static int valid_placement(const placement *p)
+{
+    return p->x >= 0 && p->y >= 0 && p->x % 2 == 0 && p->y % 2 == 0
+        && p->scale >= 1 && p->scale <= CDG_COMPOSITE_MAX_SCALE;
+}
+
+/*
+ * Finds the part of the frame covered by a rectangle of the screen, widened
+ * to whole chroma samples and clipped to the frame. Returns 0 if it is empty.
+ */
+static int frame_region(const CDG_Rect *rect, const placement *p, const CDG_YuvFrame *frame, region *r)
+{
+    r->x0 = (p->x + rect->x * p->scale) & ~1;
+    r->y0 = (p->y + rect->y * p->scale) & ~1;
+    r->x1 = (p->x + (rect->x + rect->w) * p->scale + 1) & ~1;
+    r->y1 = (p->y + (rect->y + rect->h) * p->scale + 1) & ~1;
+
+    if (r->x1 > frame->width) {
+        r->x1 = frame->width;
+    }
+    if (r->y1 > frame->height) {
+        r->y1 = frame->height;
+    }
+    return r->x0 < r->x1 && r->y0 < r->y1;
+}
+
+/*
+ * Looks up the color index of every frame pixel of one row of a region. Rows
+ * and columns outside the screen get the transparent index.
+ */
+static void expand_row(const cdg *cdg_state, const yuv_palette *pal, const placement *p,
+                       const region *r, int fy, unsigned char *out)
+{
+    int n = r->x1 - r->x0;
+    int sy = fy - p->y;
+    if (sy >= CDG_SCREEN_HEIGHT * p->scale) {
+        // Rounded out below the screen
+        memset(out, pal->transparent, n);
+        return;
+    }
+
+    unsigned char screen[CDG_SCREEN_WIDTH];
+    cdg_get_row(cdg_state, 0, sy / p->scale, CDG_SCREEN_WIDTH, screen);
+
+    // The region never starts left of the screen, since x is even
+    int i = 0;
+    int sx = r->x0 - p->x;
+    int column = sx / p->scale;
+    int within = sx % p->scale;
+    if (p->scale == 1) {
+        int run = n - i < CDG_SCREEN_WIDTH - column ? n - i : CDG_SCREEN_WIDTH - column;
+        for (int k = 0; k < run; k++) {
+            out[i + k] = screen[column + k] & 0x0F;
+        }
+        i += run;
+    } else {
+        for (; i < n && column < CDG_SCREEN_WIDTH; column++) {
+            unsigned char index = screen[column] & 0x0F;
+            int run = p->scale - within < n - i ? p->scale - within : n - i;
+            for (int k = 0; k < run; k++) {
+                out[i + k] = index;
+            }
+            i += run;
+            within = 0;
+        }
+    }
+
+    if (i < n) {
+        memset(out + i, pal->transparent, n - i);
+    }
+}
+
+// Writes the luma of n pixels, leaving transparent ones as they are
+static void luma_span(const yuv_palette *pal, const unsigned char *src, unsigned char *dst, int n)
+{
+    for (int x = 0; x < n; x++) {
+        if (src[x] != pal->transparent) {
+            dst[x] = pal->y[src[x]];
+        }
+    }
+}
+
+#ifdef __SSSE3__
+/*
+ * Writes the luma of 16 pixels at a time, with one byte shuffle for the table
+ * lookup and a compare for the transparent pixels, which are blended back in
+ * from the frame. Spans that are all transparent are not touched at all.
+ * Returns the number of pixels done; the rest is left to luma_span.
+ */
+static int luma_span_ssse3(const yuv_palette *pal, const unsigned char *src, unsigned char *dst, int n)
+{
+    const __m128i table = _mm_loadu_si128((const __m128i *)pal->y);
+    const __m128i transparent = _mm_set1_epi8(pal->transparent);
+    int x = 0;
+
+    for (; x + 16 <= n; x += 16) {
+        __m128i index = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i keep = _mm_cmpeq_epi8(index, transparent);
+        int mask = _mm_movemask_epi8(keep);
+        if (mask == 0xFFFF) {
+            continue;
+        }
+
+        __m128i luma = _mm_shuffle_epi8(table, index);
+        if (mask != 0) {
+            __m128i video = _mm_loadu_si128((const __m128i *)(dst + x));
+            luma = _mm_or_si128(_mm_and_si128(keep, video), _mm_andnot_si128(keep, luma));
+        }
+        _mm_storeu_si128((__m128i *)(dst + x), luma);
+    }
+
+    return x;
+}
+#endif
+
+/*
+ * Mixes the chroma of the four pixels of one sample. Transparent pixels count
+ * with the chroma already in the frame.
+ */
+static unsigned char mix(const int *table, unsigned char transparent, const unsigned char *a,
+                         const unsigned char *b, unsigned char video)
+{
+    int sum = 0;
+    sum += a[0] == transparent ? video : table[a[0]];
+    sum += a[1] == transparent ? video : table[a[1]];
+    sum += b[0] == transparent ? video : table[b[0]];
+    sum += b[1] == transparent ? video : table[b[1]];
+    return (sum + 2) / 4;
+}
+
+// Writes the chroma of the samples under two rows of pixels
+static void chroma_span(const yuv_palette *pal, const CDG_YuvFrame *frame, const region *r, int fy,
+                        const unsigned char *row0, const unsigned char *row1)
+{
+    unsigned char t = pal->transparent;
+    int cy = fy / 2;
+    int n = (r->x1 - r->x0) / 2;
+
+    // U and V are step bytes apart, and so are the samples
+    unsigned char *u;
+    unsigned char *v;
+    int step;
+    if (frame->layout == CDG_YUV_NV12) {
+        u = frame->planes[1] + cy * frame->strides[1] + r->x0;
+        v = u + 1;
+        step = 2;
+    } else {
+        u = frame->planes[1] + cy * frame->strides[1] + r->x0 / 2;
+        v = frame->planes[2] + cy * frame->strides[2] + r->x0 / 2;
+        step = 1;
+    }
+
+    for (int c = 0; c < n; c++) {
+        const unsigned char *a = row0 + 2 * c;
+        const unsigned char *b = row1 + 2 * c;
+
+        // Scaled up, most samples lie within one screen pixel
+        unsigned char index = a[0];
+        if (a[1] == index && b[0] == index && b[1] == index) {
+            if (index != t) {
+                u[c * step] = pal->u[index];
+                v[c * step] = pal->v[index];
+            }
+            continue;
+        }
+
+        u[c * step] = mix(pal->u, t, a, b, u[c * step]);
+        v[c * step] = mix(pal->v, t, a, b, v[c * step]);
+    }
+}
+
+static void composite_region(const cdg *cdg_state, const yuv_palette *pal, const placement *p,
+                             const region *r, const CDG_YuvFrame *frame)
+{
+    unsigned char rows[2][ROW_LENGTH];
+    int n = r->x1 - r->x0;
+
+    for (int fy = r->y0; fy < r->y1; fy += 2) {
+        // With scaling, both rows usually show the same screen row
+        const unsigned char *row0 = rows[0];
+        const unsigned char *row1 = rows[1];
+        expand_row(cdg_state, pal, p, r, fy, rows[0]);
+        if ((fy - p->y) / p->scale == (fy + 1 - p->y) / p->scale) {
+            row1 = row0;
+        } else {
+            expand_row(cdg_state, pal, p, r, fy + 1, rows[1]);
+        }
+
+        for (int i = 0; i < 2; i++) {
+            const unsigned char *src = i == 0 ? row0 : row1;
+            unsigned char *dst = frame->planes[0] + (fy + i) * frame->strides[0] + r->x0;
+            int done = 0;
+#ifdef __SSSE3__
+            done = luma_span_ssse3(pal, src, dst, n);
+#endif
+            luma_span(pal, src + done, dst + done, n - done);
+        }
+
+        chroma_span(pal, frame, r, fy, row0, row1);
+    }
+}
+
+// Copies a region of one frame to another of the same size and layout
+static void copy_region(const CDG_YuvFrame *from, const CDG_YuvFrame *to, const region *r)
+{
+    int n = r->x1 - r->x0;
+    for (int fy = r->y0; fy < r->y1; fy++) {
+        memcpy(to->planes[0] + fy * to->strides[0] + r->x0,
+               from->planes[0] + fy * from->strides[0] + r->x0, n);
+    }
+
+    for (int cy = r->y0 / 2; cy < r->y1 / 2; cy++) {
+        if (to->layout == CDG_YUV_NV12) {
+            memcpy(to->planes[1] + cy * to->strides[1] + r->x0,
+                   from->planes[1] + cy * from->strides[1] + r->x0, n);
+            continue;
+        }
+        for (int k = 1; k < 3; k++) {
+            memcpy(to->planes[k] + cy * to->strides[k] + r->x0 / 2,
+                   from->planes[k] + cy * from->strides[k] + r->x0 / 2, n / 2);
+        }
+    }
+}
+
+int cdg_composite_rect(const cdg *cdg_state, const CDG_Rect *rect, const CDG_YuvFrame *frame,
+                       int x, int y, int scale)
+{
+    placement p = { x, y, scale };
+    if (rect->x < 0 || rect->y < 0 || rect->w < 0 || rect->h < 0
+            || rect->x + rect->w > CDG_SCREEN_WIDTH
+            || rect->y + rect->h > CDG_SCREEN_HEIGHT
+            || !valid_frame(frame) || !valid_placement(&p)) {
+        return 1;
+    }
+
+    yuv_palette pal;
+    build_palette(cdg_state, &pal);
+
+    region r;
+    if (frame_region(rect, &p, frame, &r)) {
+        composite_region(cdg_state, &pal, &p, &r, frame);
+    }
+    return 0;
+}
+
+int cdg_composite(const cdg *cdg_state, const CDG_YuvFrame *frame, int x, int y, int scale)
+{
+    CDG_Rect screen = { 0, 0, CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT };
+    return cdg_composite_rect(cdg_state, &screen, frame, x, y, scale);
+}
+
+int cdg_composite_dirty(cdg *cdg_state, const CDG_YuvFrame *background, const CDG_YuvFrame *frame,
+                        int x, int y, int scale)
+{
+    placement p = { x, y, scale };
+    if (!valid_frame(frame) || !valid_placement(&p)) {
+        return -1;
+    }
+    if (background != NULL && (!valid_frame(background) || background->layout != frame->layout
+            || background->width != frame->width || background->height != frame->height)) {
+        return -1;
+    }
+
+    yuv_palette pal;
+    build_palette(cdg_state, &pal);
+
+    int count = 0;
+    CDG_Rect rect;
+    while (cdg_dirty_next(cdg_state, &rect)) {
+        region r;
+        if (frame_region(&rect, &p, frame, &r)) {
+            if (background != NULL) {
+                copy_region(background, frame, &r);
+            }
+            composite_region(cdg_state, &pal, &p, &r, frame);
+        }
+        count++;
+    }
+
+    return count;
+}
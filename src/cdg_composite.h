@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Compositing of the screen onto 4:2:0 YUV video frames, for overlaying
+ * lyrics on background video without going through RGB. The screen is scaled
+ * up by a whole factor and placed anywhere on the frame, and pixels of the
+ * transparent color leave the video showing through.
+ */
+
+#ifndef CDG_COMPOSITE_H
+#define CDG_COMPOSITE_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+// The largest scale factor, which fits the screen on an 8K frame
+#define CDG_COMPOSITE_MAX_SCALE 16
+
+/*
+ * Plane layouts. Both have a full size Y plane and chroma at half the
+ * resolution in each direction. I420 keeps U and V in planes of their own,
+ * while NV12 interleaves them in one plane, U first.
+ */
+typedef enum {
+    CDG_YUV_I420,
+    CDG_YUV_NV12
+} CDG_YuvLayout;
+
+typedef struct {
+    CDG_YuvLayout layout;
+    int width;  // In pixels, even
+    int height; // In pixels, even
+    // Y, U and V planes for I420. Y and UV for NV12, where the third is unused.
+    unsigned char *planes[3];
+    size_t strides[3]; // In bytes
+} CDG_YuvFrame;
+
+/*
+ * Composites a rectangle of the screen onto a frame, with the top left corner
+ * of the screen at x, y on the frame and every screen pixel covering scale
+ * by scale frame pixels. Whatever falls outside the frame is clipped. Colors
+ * are converted with BT.601 in the limited range. Chroma samples partly
+ * covered by transparent pixels are blended with the video. x and y must be
+ * even, so that screen pixels line up with chroma samples. Returns 0 on
+ * success and 1 if anything is invalid.
+ */
+int cdg_composite_rect(const cdg *cdg_state, const CDG_Rect *rect, const CDG_YuvFrame *frame,
+                       int x, int y, int scale);
+
+// Composites the whole screen, see cdg_composite_rect
+int cdg_composite(const cdg *cdg_state, const CDG_YuvFrame *frame, int x, int y, int scale);
+
+/*
+ * Composites only the dirty rectangles of the screen and clears them, see
+ * cdg_dirty_next. This is for a frame that keeps its contents between calls
+ * over a background that does not change, such as a still image. The frame is
+ * first restored from the background under each rectangle, so that pixels
+ * which became transparent show the background again. background may be
+ * NULL if nothing on the screen is ever transparent. Returns the number of
+ * rectangles composited, or -1 if anything is invalid.
+ */
+int cdg_composite_dirty(cdg *cdg_state, const CDG_YuvFrame *background, const CDG_YuvFrame *frame,
+                        int x, int y, int scale);
+
+#endif // CDG_COMPOSITE_H
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_convert.h"
+
+#include <stdint.h> // uint16_t, uint32_t
+#include <string.h> // memcpy
+
+#ifdef __SSSE3__
+#include <tmmintrin.h> // _mm_shuffle_epi8
+#endif
+
+/*
+ * The palette expanded to the output format, split into one 16-entry table
+ * per output byte. planes[k][i] is byte k of the pixel for color index i, so
+ * a table lookup for 16 pixels at once is a single byte shuffle.
+ */
+typedef struct {
+    int bytes_per_pixel;
+    unsigned char planes[4][16];
+    // The same, as whole pixels for the 4 and 2 byte formats
+    uint32_t pixels32[16];
+    uint16_t pixels16[16];
+} palette;
+
+// Expands a 4-bit color channel to 8 bits
+static unsigned char expand4(unsigned char c)
+{
+    return (c & 0x0F) * 0x11;
+}
+
+static int build_palette(const CDG_RGB color_table[16], CDG_PixelFormat format, palette *pal)
+{
+    pal->bytes_per_pixel = cdg_format_bytes_per_pixel(format);
+    if (pal->bytes_per_pixel == 0) {
+        return 1;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        CDG_RGB rgb = color_table[i];
+        unsigned char r = expand4(rgb.red);
+        unsigned char g = expand4(rgb.green);
+        unsigned char b = expand4(rgb.blue);
+        unsigned char bytes[4] = { 0, 0, 0, 0 };
+
+        switch (format) {
+            case CDG_FORMAT_RGBA8888:
+                bytes[0] = r;
+                bytes[1] = g;
+                bytes[2] = b;
+                bytes[3] = 0xFF;
+                break;
+            case CDG_FORMAT_BGRA8888:
+                bytes[0] = b;
+                bytes[1] = g;
+                bytes[2] = r;
+                bytes[3] = 0xFF;
+                break;
+            case CDG_FORMAT_RGB565: {
+                uint16_t value = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                memcpy(bytes, &value, sizeof(value));
+                break;
+            }
+            case CDG_FORMAT_RGB24:
+                bytes[0] = r;
+                bytes[1] = g;
+                bytes[2] = b;
+                break;
+        }
+
+        for (int k = 0; k < 4; k++) {
+            pal->planes[k][i] = bytes[k];
+        }
+        memcpy(&pal->pixels32[i], bytes, sizeof(pal->pixels32[i]));
+        memcpy(&pal->pixels16[i], bytes, sizeof(pal->pixels16[i]));
+    }
+
+    return 0;
+}
+
+// Converts n pixels of one row with plain table lookups
+static void convert_span(const palette *pal, const unsigned char *src, unsigned char *dst, int n)
+{
+    switch (pal->bytes_per_pixel) {
+        case 4:
+            for (int x = 0; x < n; x++) {
+                memcpy(dst + x * 4, &pal->pixels32[src[x] & 0x0F], 4);
+            }
+            break;
+        case 2:
+            for (int x = 0; x < n; x++) {
+                memcpy(dst + x * 2, &pal->pixels16[src[x] & 0x0F], 2);
+            }
+            break;
+        default:
+            for (int x = 0; x < n; x++) {
+                unsigned char index = src[x] & 0x0F;
+                for (int k = 0; k < pal->bytes_per_pixel; k++) {
+                    dst[x * pal->bytes_per_pixel + k] = pal->planes[k][index];
+                }
+            }
+            break;
+    }
+}
+
+#ifdef __SSSE3__
+/*
+ * Converts the pixels of one row 16 at a time, looking up every output byte
+ * plane with a byte shuffle and interleaving the planes into pixels. Returns
+ * the number of pixels converted; the rest is left to convert_span.
+ */
+static int convert_span_ssse3(const palette *pal, const unsigned char *src, unsigned char *dst, int n)
+{
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    int x = 0;
+
+    if (pal->bytes_per_pixel == 4) {
+        const __m128i p0 = _mm_loadu_si128((const __m128i *)pal->planes[0]);
+        const __m128i p1 = _mm_loadu_si128((const __m128i *)pal->planes[1]);
+        const __m128i p2 = _mm_loadu_si128((const __m128i *)pal->planes[2]);
+        const __m128i p3 = _mm_loadu_si128((const __m128i *)pal->planes[3]);
+
+        for (; x + 16 <= n; x += 16) {
+            __m128i index = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + x)), low_nibble);
+            __m128i b0 = _mm_shuffle_epi8(p0, index);
+            __m128i b1 = _mm_shuffle_epi8(p1, index);
+            __m128i b2 = _mm_shuffle_epi8(p2, index);
+            __m128i b3 = _mm_shuffle_epi8(p3, index);
+
+            __m128i b01_lo = _mm_unpacklo_epi8(b0, b1);
+            __m128i b01_hi = _mm_unpackhi_epi8(b0, b1);
+            __m128i b23_lo = _mm_unpacklo_epi8(b2, b3);
+            __m128i b23_hi = _mm_unpackhi_epi8(b2, b3);
+
+            __m128i *out = (__m128i *)(dst + x * 4);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(b01_lo, b23_lo));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(b01_lo, b23_lo));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(b01_hi, b23_hi));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(b01_hi, b23_hi));
+        }
+    } else if (pal->bytes_per_pixel == 2) {
+        const __m128i p0 = _mm_loadu_si128((const __m128i *)pal->planes[0]);
+        const __m128i p1 = _mm_loadu_si128((const __m128i *)pal->planes[1]);
+
+        for (; x + 16 <= n; x += 16) {
+            __m128i index = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + x)), low_nibble);
+            __m128i b0 = _mm_shuffle_epi8(p0, index);
+            __m128i b1 = _mm_shuffle_epi8(p1, index);
+
+            __m128i *out = (__m128i *)(dst + x * 2);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi8(b0, b1));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(b0, b1));
+        }
+    }
+
+    return x;
+}
+#endif
+
+int cdg_format_bytes_per_pixel(CDG_PixelFormat format)
+{
+    switch (format) {
+        case CDG_FORMAT_RGBA8888:
+        case CDG_FORMAT_BGRA8888:
+            return 4;
+        case CDG_FORMAT_RGB565:
+            return 2;
+        case CDG_FORMAT_RGB24:
+            return 3;
+    }
+
+    return 0;
+}
+
+// Converts one row of color indices
+static void convert_row(const palette *pal, const unsigned char *src, unsigned char *out, int n)
+{
+    int done = 0;
+#ifdef __SSSE3__
+    done = convert_span_ssse3(pal, src, out, n);
+#endif
+    convert_span(pal, src + done, out + done * pal->bytes_per_pixel, n - done);
+}
+
+static void convert_rect(const cdg *cdg_state, const CDG_Rect *rect,
+                         const palette *pal, unsigned char *dst, size_t stride)
+{
+    int bpp = pal->bytes_per_pixel;
+
+    // Room for a full row, plus slack for the 16-byte loads
+    unsigned char src[CDG_SCREEN_WIDTH + 16];
+
+    for (int y = rect->y; y < rect->y + rect->h; y++) {
+        cdg_get_row(cdg_state, rect->x, y, rect->w, src);
+        convert_row(pal, src, dst + y * stride + rect->x * bpp, rect->w);
+    }
+}
+
+int cdg_convert_rect(const cdg *cdg_state, const CDG_Rect *rect,
+                     CDG_PixelFormat format, void *dst, size_t stride)
+{
+    if (rect->x < 0 || rect->y < 0 || rect->w < 0 || rect->h < 0
+            || rect->x + rect->w > CDG_SCREEN_WIDTH
+            || rect->y + rect->h > CDG_SCREEN_HEIGHT) {
+        return 1;
+    }
+
+    palette pal;
+    if (build_palette(cdg_state->color_table, format, &pal) != 0) {
+        return 1;
+    }
+
+    convert_rect(cdg_state, rect, &pal, dst, stride);
+    return 0;
+}
+
+int cdg_convert(const cdg *cdg_state, CDG_PixelFormat format, void *dst, size_t stride)
+{
+    CDG_Rect screen = { 0, 0, CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT };
+    return cdg_convert_rect(cdg_state, &screen, format, dst, stride);
+}
+
+int cdg_convert_dirty(cdg *cdg_state, CDG_PixelFormat format, void *dst, size_t stride)
+{
+    palette pal;
+    if (build_palette(cdg_state->color_table, format, &pal) != 0) {
+        return 0;
+    }
+
+    int count = 0;
+    CDG_Rect rect;
+    while (cdg_dirty_next(cdg_state, &rect)) {
+        convert_rect(cdg_state, &rect, &pal, dst, stride);
+        count++;
+    }
+
+    return count;
+}
+
+int cdg_convert_palette(const cdg *cdg_state, CDG_PixelFormat format, void *dst)
+{
+    palette pal;
+    if (build_palette(cdg_state->color_table, format, &pal) != 0) {
+        return 1;
+    }
+
+    static const unsigned char indices[16] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+    convert_span(&pal, indices, dst, 16);
+    return 0;
+}
+
+static void copy_indexed(const cdg *cdg_state, const CDG_Rect *rect, unsigned char *dst, size_t stride)
+{
+    for (int y = rect->y; y < rect->y + rect->h; y++) {
+        cdg_get_row(cdg_state, rect->x, y, rect->w, dst + y * stride + rect->x);
+    }
+}
+
+int cdg_convert_indexed_rect(const cdg *cdg_state, const CDG_Rect *rect, void *dst, size_t stride)
+{
+    if (rect->x < 0 || rect->y < 0 || rect->w < 0 || rect->h < 0
+            || rect->x + rect->w > CDG_SCREEN_WIDTH
+            || rect->y + rect->h > CDG_SCREEN_HEIGHT) {
+        return 1;
+    }
+
+    copy_indexed(cdg_state, rect, dst, stride);
+    return 0;
+}
+
+int cdg_convert_indexed(const cdg *cdg_state, void *dst, size_t stride)
+{
+    CDG_Rect screen = { 0, 0, CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT };
+    return cdg_convert_indexed_rect(cdg_state, &screen, dst, stride);
+}
+
+int cdg_convert_indexed_dirty(cdg *cdg_state, void *dst, size_t stride, int *palette_changed)
+{
+    *palette_changed = cdg_palette_next(cdg_state);
+
+    int count = 0;
+    CDG_Rect rect;
+    while (cdg_dirty_next(cdg_state, &rect)) {
+        copy_indexed(cdg_state, &rect, dst, stride);
+        count++;
+    }
+
+    return count;
+}
+
+int cdg_compact_convert(const CDG_Compact *compact, CDG_PixelFormat format, void *dst, size_t stride)
+{
+    palette pal;
+    if (build_palette(compact->color_table, format, &pal) != 0) {
+        return 1;
+    }
+
+    unsigned char src[CDG_SCREEN_WIDTH + 16];
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        cdg_compact_get_row(compact, 0, y, CDG_SCREEN_WIDTH, src);
+        convert_row(&pal, src, (unsigned char *)dst + y * stride, CDG_SCREEN_WIDTH);
+    }
+    return 0;
+}
+
+void cdg_compact_convert_indexed(const CDG_Compact *compact, void *dst, size_t stride)
+{
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        cdg_compact_get_row(compact, 0, y, CDG_SCREEN_WIDTH, (unsigned char *)dst + y * stride);
+    }
+}
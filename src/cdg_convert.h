@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Conversion of the indexed framebuffer in the cdg state to true color
+ * pixels, for handing off to a renderer.
+ */
+
+#ifndef CDG_CONVERT_H
+#define CDG_CONVERT_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+#include "cdg_compact.h"
+
+/*
+ * Output pixel formats. The 8-bit-per-channel formats are named by their
+ * byte order in memory, while RGB565 is a native-endian 16-bit value with red
+ * in the most significant bits. Alpha is always opaque.
+ */
+typedef enum {
+    CDG_FORMAT_RGBA8888,
+    CDG_FORMAT_BGRA8888,
+    CDG_FORMAT_RGB565,
+    CDG_FORMAT_RGB24
+} CDG_PixelFormat;
+
+// Returns the number of bytes used for one pixel in the given format
+int cdg_format_bytes_per_pixel(CDG_PixelFormat format);
+
+// Converts a rectangle of the screen. dst points to the top left pixel of a
+// full screen image with the given stride in bytes, and only the pixels
+// inside the rectangle are written. Returns 0 on success and 1 if the format
+// or rectangle is invalid.
+int cdg_convert_rect(const cdg *cdg_state, const CDG_Rect *rect,
+                     CDG_PixelFormat format, void *dst, size_t stride);
+
+// Converts the whole screen, see cdg_convert_rect
+int cdg_convert(const cdg *cdg_state, CDG_PixelFormat format, void *dst, size_t stride);
+
+// Converts every dirty rectangle of the screen and clears them, see
+// cdg_dirty_next. Returns the number of rectangles converted.
+int cdg_convert_dirty(cdg *cdg_state, CDG_PixelFormat format, void *dst, size_t stride);
+
+/*
+ * Indexed output, for renderers with a paletted surface. Pixels are written
+ * as their color index, one byte each from 0 to 15, and the palette is
+ * converted on its own, so that a new palette costs 16 colors instead of
+ * converting every pixel again.
+ */
+
+// Converts the 16 colors of the palette to the given format, one pixel after
+// the other. Returns 0 on success and 1 if the format is invalid.
+int cdg_convert_palette(const cdg *cdg_state, CDG_PixelFormat format, void *dst);
+
+// Copies the color indices of a rectangle of the screen, like
+// cdg_convert_rect. Returns 0 on success and 1 if the rectangle is invalid.
+int cdg_convert_indexed_rect(const cdg *cdg_state, const CDG_Rect *rect, void *dst, size_t stride);
+
+// Copies the color indices of the whole screen
+int cdg_convert_indexed(const cdg *cdg_state, void *dst, size_t stride);
+
+// Copies the color indices of every dirty rectangle and clears them. The
+// palette change is taken first, see cdg_palette_next, and palette_changed
+// is set to 1 if the palette needs converting again and 0 if not. Returns the
+// number of rectangles copied.
+int cdg_convert_indexed_dirty(cdg *cdg_state, void *dst, size_t stride, int *palette_changed);
+
+/*
+ * Whole frames of a compact state, see cdg_compact.h
+ */
+
+// Converts the whole screen, see cdg_convert. Returns 0 on success and 1 if
+// the format is invalid.
+int cdg_compact_convert(const CDG_Compact *compact, CDG_PixelFormat format, void *dst, size_t stride);
+
+// Copies the color indices of the whole screen, one byte each
+void cdg_compact_convert_indexed(const CDG_Compact *compact, void *dst, size_t stride);
+
+#endif // CDG_CONVERT_H
@@ -0,0 +1,427 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_encode.h"
+
+#include <stdlib.h> // realloc, free
+#include <string.h> // memset, memcpy, memcmp
+
+// No tile ever needs more packets than this, see encode_tile
+#define MAX_TILE_PACKETS 4
+
+// A frame needs at most two presets, every tile and two palette loads
+#define MAX_FRAME_PACKETS (2 + CDG_TILES_X * CDG_TILES_Y * MAX_TILE_PACKETS + 2)
+
+#define BORDER_WIDTH ((CDG_SCREEN_WIDTH - CDG_VIEW_WIDTH) / 2)
+#define BORDER_HEIGHT ((CDG_SCREEN_HEIGHT - CDG_VIEW_HEIGHT) / 2)
+
+typedef unsigned char tile_pixels[CDG_TILE_HEIGHT][CDG_TILE_WIDTH];
+
+static void make_packet(SubCode *sub, unsigned char instruction)
+{
+    memset(sub, 0, sizeof(*sub));
+    sub->command = CDG_COMMAND;
+    sub->instruction = instruction;
+}
+
+static void make_tile(SubCode *sub, unsigned char instruction, int row, int column,
+                      unsigned char color0, unsigned char color1, const unsigned char bits[12])
+{
+    make_packet(sub, instruction);
+    sub->data[0] = color0;
+    sub->data[1] = color1;
+    sub->data[2] = row;
+    sub->data[3] = column;
+    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        sub->data[4 + i] = bits[i];
+    }
+}
+
+// Applies a packet to a state, the same way a decoder would
+static void apply(cdg *cdg_state, const SubCode *sub)
+{
+    CDG_Packet packet = cdg_parse_packet(sub);
+    cdg_process_packet(&packet, cdg_state);
+}
+
+static void get_tile(const unsigned char *pixels, size_t stride, int row, int column, tile_pixels out)
+{
+    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        const unsigned char *src = pixels + (row * CDG_TILE_HEIGHT + i) * stride + column * CDG_TILE_WIDTH;
+        for (int j = 0; j < CDG_TILE_WIDTH; j++) {
+            out[i][j] = src[j] & 0x0F;
+        }
+    }
+}
+
+// Builds the 6-bit rows of a tile, with a bit set where the pixel matches
+static void tile_bits(tile_pixels pixels, unsigned char value, unsigned char mask,
+                      unsigned char bits[12])
+{
+    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        bits[i] = 0;
+        for (int j = 0; j < CDG_TILE_WIDTH; j++) {
+            if ((pixels[i][j] & mask) == value) {
+                bits[i] |= 0x20 >> j;
+            }
+        }
+    }
+}
+
+// Lists the distinct values in a tile. Returns how many there are.
+static int tile_colors(tile_pixels pixels, unsigned char colors[16])
+{
+    int seen = 0;
+    int count = 0;
+    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        for (int j = 0; j < CDG_TILE_WIDTH; j++) {
+            if ((seen & (1 << pixels[i][j])) == 0) {
+                seen |= 1 << pixels[i][j];
+                colors[count++] = pixels[i][j];
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * Finds the fewest packets that turn the current tile into the target one.
+ * Returns how many there are, and writes them to out if it is not NULL.
+ *
+ * - A tile that differs from what is shown by XOR with at most two values,
+ *   like a highlight wipe over lyrics, takes one TILE_BLOCK_XOR.
+ * - A tile with at most two colors takes one TILE_BLOCK.
+ * - A tile with three colors takes a TILE_BLOCK drawing two of them, and a
+ *   TILE_BLOCK_XOR turning some of one into the third.
+ * - Anything else is drawn one bit plane at a time: a TILE_BLOCK for the
+ *   lowest bit, and a TILE_BLOCK_XOR for each higher bit in use.
+ */
+static int encode_tile(tile_pixels target, tile_pixels current,
+                       int row, int column, SubCode *out)
+{
+    tile_pixels diff;
+    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        for (int j = 0; j < CDG_TILE_WIDTH; j++) {
+            diff[i][j] = target[i][j] ^ current[i][j];
+        }
+    }
+
+    unsigned char colors[16];
+    unsigned char bits[12];
+
+    int diff_count = tile_colors(diff, colors);
+    if (diff_count == 1 && colors[0] == 0) {
+        return 0;
+    }
+    if (diff_count <= 2) {
+        if (out != NULL) {
+            unsigned char color1 = diff_count == 2 ? colors[1] : colors[0];
+            tile_bits(diff, color1, 0x0F, bits);
+            make_tile(out, CDG_TILE_BLOCK_XOR, row, column, colors[0], color1, bits);
+        }
+        return 1;
+    }
+
+    int count = tile_colors(target, colors);
+    if (count <= 2) {
+        if (out != NULL) {
+            unsigned char color1 = count == 2 ? colors[1] : colors[0];
+            tile_bits(target, color1, 0x0F, bits);
+            make_tile(out, CDG_TILE_BLOCK, row, column, colors[0], color1, bits);
+        }
+        return 1;
+    }
+
+    if (count == 3) {
+        if (out != NULL) {
+            // Draw the third color as the first one, then flip it over
+            tile_bits(target, colors[1], 0x0F, bits);
+            make_tile(&out[0], CDG_TILE_BLOCK, row, column, colors[0], colors[1], bits);
+            tile_bits(target, colors[2], 0x0F, bits);
+            make_tile(&out[1], CDG_TILE_BLOCK_XOR, row, column, 0, colors[0] ^ colors[2], bits);
+        }
+        return 2;
+    }
+
+    int packets = 0;
+    for (int plane = 0; plane < 4; plane++) {
+        unsigned char mask = 1 << plane;
+        tile_bits(target, mask, mask, bits);
+        int used = 0;
+        for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+            used |= bits[i];
+        }
+        if (plane > 0 && !used) {
+            continue;
+        }
+        if (out != NULL) {
+            make_tile(&out[packets], plane == 0 ? CDG_TILE_BLOCK : CDG_TILE_BLOCK_XOR,
+                      row, column, 0, mask, bits);
+        }
+        packets++;
+    }
+    return packets;
+}
+
+// Most tiles stay the same from one frame to the next, so check that first
+static int same_tile(const CDG_Frame *frame, const cdg *cdg_state, int row, int column)
+{
+    for (int i = 0; i < CDG_TILE_HEIGHT; i++) {
+        int y = row * CDG_TILE_HEIGHT + i;
+        int x = column * CDG_TILE_WIDTH;
+        if (memcmp(frame->pixels + y * frame->stride + x, &cdg_state->pixels[y][x], CDG_TILE_WIDTH) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Encodes every tile that differs between the state and the frame. Returns
+// the number of packets, which are written to out unless it is NULL.
+static size_t encode_tiles(const cdg *cdg_state, const CDG_Frame *frame, SubCode *out)
+{
+    size_t count = 0;
+    tile_pixels target;
+    tile_pixels current;
+
+    for (int row = 0; row < CDG_TILES_Y; row++) {
+        for (int column = 0; column < CDG_TILES_X; column++) {
+            // The encoder never scrolls, so the origin is always at 0, 0
+            if (same_tile(frame, cdg_state, row, column)) {
+                continue;
+            }
+            get_tile(frame->pixels, frame->stride, row, column, target);
+            get_tile(&cdg_state->pixels[0][0], CDG_SCREEN_STRIDE, row, column, current);
+            count += encode_tile(target, current, row, column, out != NULL ? out + count : NULL);
+        }
+    }
+
+    return count;
+}
+
+static int in_border(int x, int y)
+{
+    return x < BORDER_WIDTH || x >= CDG_SCREEN_WIDTH - BORDER_WIDTH
+        || y < BORDER_HEIGHT || y >= CDG_SCREEN_HEIGHT - BORDER_HEIGHT;
+}
+
+/*
+ * Finds the presets worth trying before the tiles: a border preset if the
+ * border of the frame is a single color, and a memory preset with the most
+ * common color inside the border.
+ */
+static void find_presets(const CDG_Frame *frame, int *border_color, int *memory_color)
+{
+    size_t histogram[16] = { 0 };
+    *border_color = frame->pixels[0] & 0x0F;
+
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        const unsigned char *row = frame->pixels + y * frame->stride;
+        for (int x = 0; x < CDG_SCREEN_WIDTH; x++) {
+            if (!in_border(x, y)) {
+                histogram[row[x] & 0x0F]++;
+            } else if ((row[x] & 0x0F) != *border_color) {
+                *border_color = -1;
+            }
+        }
+    }
+
+    *memory_color = 0;
+    for (int i = 1; i < 16; i++) {
+        if (histogram[i] > histogram[*memory_color]) {
+            *memory_color = i;
+        }
+    }
+}
+
+// Counts the packets needed when starting with the given presets
+static size_t plan_cost(CDG_Encoder *encoder, const CDG_Frame *frame,
+                        const SubCode *presets, int preset_count)
+{
+    CDG_Log *log = encoder->scratch.log;
+    CDG_Stats *stats = encoder->scratch.stats;
+    encoder->scratch = encoder->cdg_state;
+    encoder->scratch.log = log;
+    encoder->scratch.stats = stats;
+
+    for (int i = 0; i < preset_count; i++) {
+        apply(&encoder->scratch, &presets[i]);
+    }
+    return preset_count + encode_tiles(&encoder->scratch, frame, NULL);
+}
+
+static int reserve(CDG_Encoder *encoder, size_t count)
+{
+    if (count <= encoder->capacity) {
+        return 0;
+    }
+
+    size_t capacity = encoder->capacity == 0 ? 4096 : encoder->capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    SubCode *packets = realloc(encoder->packets, capacity * sizeof(SubCode));
+    if (packets == NULL) {
+        return -1;
+    }
+    encoder->packets = packets;
+    encoder->capacity = capacity;
+    return 0;
+}
+
+static void make_colors(SubCode *sub, unsigned char instruction, const CDG_RGB colors[8])
+{
+    make_packet(sub, instruction);
+    for (int i = 0; i < 8; i++) {
+        // [---high byte---]   [---low byte----]
+        //  X X r r r r g g     X X g g b b b b
+        unsigned char red = colors[i].red & 0x0F;
+        unsigned char green = colors[i].green & 0x0F;
+        unsigned char blue = colors[i].blue & 0x0F;
+        sub->data[2 * i] = (red << 2) | (green >> 2);
+        sub->data[2 * i + 1] = ((green & 0x03) << 4) | blue;
+    }
+}
+
+static int same_colors(const CDG_RGB *a, const CDG_RGB *b, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if ((a[i].red & 0x0F) != (b[i].red & 0x0F)
+                || (a[i].green & 0x0F) != (b[i].green & 0x0F)
+                || (a[i].blue & 0x0F) != (b[i].blue & 0x0F)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Checks that the decoder ended up showing exactly the frame
+static int matches(const cdg *cdg_state, const CDG_Frame *frame)
+{
+    if (!same_colors(cdg_state->color_table, frame->color_table, 16)) {
+        return 0;
+    }
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        const unsigned char *row = frame->pixels + y * frame->stride;
+        for (int x = 0; x < CDG_SCREEN_WIDTH; x++) {
+            if (cdg_state->pixels[y][x] != (row[x] & 0x0F)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void cdg_encoder_init(CDG_Encoder *encoder)
+{
+    cdg_init(&encoder->cdg_state);
+    cdg_init(&encoder->scratch);
+    encoder->packets = NULL;
+    encoder->count = 0;
+    encoder->capacity = 0;
+}
+
+int cdg_encoder_add_frame(CDG_Encoder *encoder, const CDG_Frame *frame)
+{
+    // Pick the cheapest of drawing only tiles, or starting with presets
+    int border_color;
+    int memory_color;
+    find_presets(frame, &border_color, &memory_color);
+
+    SubCode presets[2];
+    int preset_count = 0;
+    size_t best = plan_cost(encoder, frame, NULL, 0);
+
+    SubCode candidate[2];
+    int candidate_count = 0;
+    make_packet(&candidate[candidate_count], CDG_MEMORY_PRESET);
+    candidate[candidate_count++].data[0] = memory_color;
+    if (border_color >= 0) {
+        make_packet(&candidate[candidate_count], CDG_BORDER_PRESET);
+        candidate[candidate_count++].data[0] = border_color;
+    }
+
+    // Try the border preset on its own, and together with the memory preset
+    for (int first = candidate_count - 1; first >= 0; first--) {
+        size_t cost = plan_cost(encoder, frame, &candidate[first], candidate_count - first);
+        if (cost < best) {
+            best = cost;
+            preset_count = candidate_count - first;
+            memcpy(presets, &candidate[first], preset_count * sizeof(SubCode));
+        }
+    }
+
+    int load_low = !same_colors(encoder->cdg_state.color_table, frame->color_table, 8);
+    int load_high = !same_colors(encoder->cdg_state.color_table + 8, frame->color_table + 8, 8);
+    size_t needed = best + load_low + load_high;
+
+    // Place the packets as late as the deadline allows
+    size_t start = encoder->count;
+    int late = 0;
+    if (frame->packet >= encoder->count + needed) {
+        start = frame->packet - needed;
+    } else {
+        late = 1;
+    }
+
+    if (reserve(encoder, start + MAX_FRAME_PACKETS) != 0) {
+        return -1;
+    }
+
+    // Empty packets until it is time to start drawing
+    memset(encoder->packets + encoder->count, 0, (start - encoder->count) * sizeof(SubCode));
+
+    SubCode *out = encoder->packets + start;
+    size_t count = 0;
+    for (int i = 0; i < preset_count; i++) {
+        out[count] = presets[i];
+        apply(&encoder->cdg_state, &out[count++]);
+    }
+
+    // Tiles are encoded against what the presets left behind
+    size_t tiles = encode_tiles(&encoder->cdg_state, frame, out + count);
+    for (size_t i = 0; i < tiles; i++) {
+        apply(&encoder->cdg_state, &out[count++]);
+    }
+
+    // The palette goes last, so the old frame keeps its colors until the end
+    if (load_low) {
+        make_colors(&out[count], CDG_LOAD_COLORS_LOW, frame->color_table);
+        apply(&encoder->cdg_state, &out[count++]);
+    }
+    if (load_high) {
+        make_colors(&out[count], CDG_LOAD_COLORS_HIGH, frame->color_table + 8);
+        apply(&encoder->cdg_state, &out[count++]);
+    }
+
+    encoder->count = start + count;
+
+    if (!matches(&encoder->cdg_state, frame)) {
+        return -1;
+    }
+    return late;
+}
+
+void cdg_encoder_free(CDG_Encoder *encoder)
+{
+    free(encoder->packets);
+    encoder->packets = NULL;
+    encoder->count = 0;
+    encoder->capacity = 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * CD+G encoder. Turns a sequence of timed, indexed frames into a packet
+ * stream, using as few packets as it can find to get from what the decoder
+ * shows to each new frame.
+ */
+
+#ifndef CDG_ENCODE_H
+#define CDG_ENCODE_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+/*
+ * A frame to show. The pixels cover the full screen, border included, as
+ * color indices in row-major order.
+ */
+typedef struct {
+    size_t packet;                // The frame must be complete before this packet
+    CDG_RGB color_table[16];
+    const unsigned char *pixels;  // CDG_SCREEN_HEIGHT rows of CDG_SCREEN_WIDTH indices
+    size_t stride;                // Bytes from one row to the next
+} CDG_Frame;
+
+typedef struct {
+    cdg cdg_state;     // What a decoder shows after the packets so far
+    cdg scratch;       // Used for trying out different ways to encode a frame
+    SubCode *packets;  // The encoded stream
+    size_t count;
+    size_t capacity;
+} CDG_Encoder;
+
+// Sets up an encoder with an empty stream and a black screen
+void cdg_encoder_init(CDG_Encoder *encoder);
+
+/*
+ * Appends the packets needed to show a frame by its deadline. Packets are
+ * placed as late as possible, so the previous frame stays up until the new
+ * one has to be drawn, and the stream is padded with empty packets up to
+ * that point. Frames must be added in order.
+ *
+ * Returns 0 on success, 1 if the frame needed more packets than fit before
+ * its deadline (it is then encoded late), and -1 if out of memory or if the
+ * decoded result does not match the frame.
+ */
+int cdg_encoder_add_frame(CDG_Encoder *encoder, const CDG_Frame *frame);
+
+// Frees the encoded stream
+void cdg_encoder_free(CDG_Encoder *encoder);
+
+#endif // CDG_ENCODE_H
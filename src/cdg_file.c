@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_file.h"
+
+#include <sys/mman.h> // mmap, madvise
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <errno.h> // errno
+
+int cdg_file_open(CDG_File *file, const char *filename)
+{
+    file->packets = NULL;
+    file->count = 0;
+    file->map = NULL;
+    file->map_size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    // Empty files can not be mapped, but are still valid (and very short)
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+
+    // The decoder walks the file front to back, so let the kernel read ahead.
+    // This is only a hint, so a failure here is not an error.
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    file->map = map;
+    file->map_size = st.st_size;
+    file->packets = (const SubCode *)map;
+    file->count = file->map_size / sizeof(SubCode);
+
+    return 0;
+}
+
+void cdg_file_close(CDG_File *file)
+{
+    if (file->map != NULL) {
+        munmap(file->map, file->map_size);
+    }
+
+    file->packets = NULL;
+    file->count = 0;
+    file->map = NULL;
+    file->map_size = 0;
+}
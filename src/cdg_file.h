@@ -0,0 +1,48 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Read-only access to .cdg files through a memory mapping, so that the whole
+ * file can be handed to the decoder as an array of SubCodes without copying.
+ */
+
+#ifndef CDG_FILE_H
+#define CDG_FILE_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+typedef struct {
+    const SubCode *packets; // The packets of the file, read-only
+    size_t count;           // Number of complete packets in the file
+
+    // Internal, used to unmap the file
+    void *map;
+    size_t map_size;
+} CDG_File;
+
+// Maps the given file into memory. A trailing partial packet is not counted.
+// Returns 0 on success and -1 on failure, in which case errno is set.
+int cdg_file_open(CDG_File *file, const char *filename);
+
+// Unmaps a file opened with cdg_file_open
+void cdg_file_close(CDG_File *file);
+
+#endif // CDG_FILE_H
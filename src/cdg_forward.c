@@ -0,0 +1,279 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_forward.h"
+#include "cdg_stats.h"
+
+#include <string.h> // memset
+#include <stddef.h> // offsetof
+
+// All tile columns of one row
+#define ROW_MASK ((UINT64_C(1) << CDG_TILES_X) - 1)
+// The leftmost and rightmost tile columns
+#define EDGE_MASK (UINT64_C(1) | (UINT64_C(1) << (CDG_TILES_X - 1)))
+
+/*
+ * What overwrites what within a part of the range with the screen in one
+ * place. Each position holds the position of the last packet of its kind in
+ * the range plus one, or 0 if there is none. A packet at position i is
+ * overwritten if a position that covers it is greater than i + 1.
+ */
+typedef struct {
+    size_t end; // One past the last packet of this part
+
+    // Whether any packet overwrites an earlier one at all. If not, there is
+    // nothing to skip and the rest need not be looked at.
+    int overwrites;
+
+    size_t memory_preset;
+    size_t border_preset;
+    size_t colors_low;
+    size_t colors_high;
+    size_t transparent;
+    size_t scroll;
+
+    // The earliest of the last tile blocks over all tiles, and over the tiles
+    // on the edge of the screen. 0 unless every such tile has one.
+    size_t all_tiles;
+    size_t edge_tiles;
+
+    // The last non-XOR tile block per tile, only set where the tile's bit is
+    // set in seen, so that the table need not be cleared for every range
+    uint64_t seen[CDG_TILES_Y];
+    // Tiles drawn on by any tile block, XOR or not
+    uint64_t drawn[CDG_TILES_Y];
+    size_t tiles[CDG_TILES_Y][CDG_TILES_X];
+} segment;
+
+/*
+ * The border is narrower than a tile, so the outermost tiles are the ones
+ * partly covered by the border preset and partly by the memory preset, and
+ * all others are covered by the memory preset alone.
+ */
+static int is_edge(int row, int column)
+{
+    return row == 0 || row == CDG_TILES_Y - 1 || column == 0 || column == CDG_TILES_X - 1;
+}
+
+/*
+ * The instruction of a packet, or 0 if processing it would do nothing. This
+ * only looks at the bytes needed here, which is cheaper than parsing.
+ */
+static unsigned char instruction(const SubCode *sub)
+{
+    if ((sub->command & CDG_MASK) != CDG_COMMAND) {
+        return 0;
+    }
+
+    unsigned char instr = cdg_get_instruction(sub);
+    if (instr == CDG_MEMORY_PRESET && (sub->data[1] & 0x0F) != 0) {
+        return 0; // Repeat packet
+    }
+    return instr;
+}
+
+// Whether a scroll moves the screen, rather than only setting fine offsets
+static int moves_screen(const SubCode *sub)
+{
+    int h = (sub->data[1] & 0x30) >> 4;
+    int v = (sub->data[2] & 0x30) >> 4;
+    return h == SCROLL_RIGHT || h == SCROLL_LEFT || v == SCROLL_DOWN || v == SCROLL_UP;
+}
+
+static size_t later(size_t a, size_t b)
+{
+    return a > b ? a : b;
+}
+
+static size_t tile_block(const segment *seg, int row, int column)
+{
+    return (seg->seen[row] >> column) & 1 ? seg->tiles[row][column] : 0;
+}
+
+/*
+ * Finds what overwrites what from packet start up to and including the next
+ * scroll that moves the screen, or up to n.
+ */
+static void scan(segment *seg, const SubCode *subs, size_t start, size_t n)
+{
+    memset(seg, 0, offsetof(segment, tiles));
+
+    // Whether anything was drawn yet, which any later preset overwrites
+    int drawn = 0;
+
+    for (size_t i = start; i < n && seg->end == 0; i++) {
+        const SubCode *sub = &subs[i];
+        unsigned char instr = instruction(sub);
+        switch (instr) {
+            case CDG_MEMORY_PRESET:
+                seg->overwrites |= drawn;
+                seg->memory_preset = i + 1;
+                drawn = 1;
+                break;
+            case CDG_BORDER_PRESET:
+                seg->overwrites |= drawn;
+                seg->border_preset = i + 1;
+                drawn = 1;
+                break;
+            case CDG_TILE_BLOCK:
+            case CDG_TILE_BLOCK_XOR: {
+                int row = sub->data[2] & 0x1F;
+                int column = sub->data[3] & 0x3F;
+                if (row >= CDG_TILES_Y || column >= CDG_TILES_X) {
+                    break;
+                }
+                uint64_t bit = UINT64_C(1) << column;
+                if (instr == CDG_TILE_BLOCK) {
+                    seg->overwrites |= (seg->drawn[row] & bit) != 0
+                                    || seg->memory_preset != 0 || seg->border_preset != 0;
+                    seg->tiles[row][column] = i + 1;
+                    seg->seen[row] |= bit;
+                }
+                seg->drawn[row] |= bit;
+                drawn = 1;
+                break;
+            }
+            case CDG_LOAD_COLORS_LOW:
+                seg->overwrites |= seg->colors_low != 0;
+                seg->colors_low = i + 1;
+                break;
+            case CDG_LOAD_COLORS_HIGH:
+                seg->overwrites |= seg->colors_high != 0;
+                seg->colors_high = i + 1;
+                break;
+            case CDG_DEFINE_TRANSPARENT:
+                seg->overwrites |= seg->transparent != 0;
+                seg->transparent = i + 1;
+                break;
+            case CDG_SCROLL_PRESET:
+            case CDG_SCROLL_COPY:
+                seg->overwrites |= seg->scroll != 0;
+                seg->scroll = i + 1;
+                if (moves_screen(sub)) {
+                    seg->end = i + 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    if (seg->end == 0) {
+        seg->end = n;
+    }
+
+    // Presets can only be overwritten by tile blocks if every tile they
+    // cover has one, which is rare, so only then look for the earliest
+    if (!seg->overwrites || (seg->seen[0] & seg->seen[CDG_TILES_Y - 1]) != ROW_MASK) {
+        return;
+    }
+    int all = 1;
+    int edges = 1;
+    for (int row = 0; row < CDG_TILES_Y; row++) {
+        all = all && seg->seen[row] == ROW_MASK;
+        edges = edges && (seg->seen[row] & EDGE_MASK) == EDGE_MASK;
+    }
+    if (!edges) {
+        return;
+    }
+
+    seg->all_tiles = all ? SIZE_MAX : 0;
+    seg->edge_tiles = SIZE_MAX;
+    for (int row = 0; row < CDG_TILES_Y; row++) {
+        for (int column = 0; column < CDG_TILES_X; column++) {
+            size_t tile = seg->tiles[row][column];
+            if (all && tile < seg->all_tiles) {
+                seg->all_tiles = tile;
+            }
+            if (is_edge(row, column) && tile < seg->edge_tiles) {
+                seg->edge_tiles = tile;
+            }
+        }
+    }
+}
+
+// Whether everything the packet at position i does is undone later
+static int is_dead(const segment *seg, const SubCode *sub, size_t i)
+{
+    switch (instruction(sub)) {
+        case CDG_MEMORY_PRESET:
+            return later(seg->memory_preset, seg->all_tiles) > i + 1;
+        case CDG_BORDER_PRESET:
+            return later(seg->border_preset, seg->edge_tiles) > i + 1;
+        case CDG_TILE_BLOCK:
+        case CDG_TILE_BLOCK_XOR: {
+            int row = sub->data[2] & 0x1F;
+            int column = sub->data[3] & 0x3F;
+            if (row >= CDG_TILES_Y || column >= CDG_TILES_X) {
+                return 0;
+            }
+            size_t tile = tile_block(seg, row, column);
+            if (later(tile, seg->memory_preset) <= i + 1) {
+                return 0;
+            }
+            return !is_edge(row, column) || later(tile, seg->border_preset) > i + 1;
+        }
+        case CDG_LOAD_COLORS_LOW:
+            return seg->colors_low > i + 1;
+        case CDG_LOAD_COLORS_HIGH:
+            return seg->colors_high > i + 1;
+        case CDG_DEFINE_TRANSPARENT:
+            return seg->transparent > i + 1;
+        case CDG_SCROLL_PRESET:
+        case CDG_SCROLL_COPY:
+            // Only the fine offsets are left to overwrite, since a scroll
+            // moving the screen ends the segment
+            return seg->scroll > i + 1;
+        default:
+            return 0;
+    }
+}
+
+size_t cdg_fast_forward(const SubCode *subs, size_t n, cdg *cdg_state)
+{
+    segment seg;
+
+    size_t start = 0;
+    while (start < n) {
+        scan(&seg, subs, start, n);
+
+        // Decode the runs of packets between the dead ones
+        size_t run = start;
+        for (size_t i = start; i < seg.end && seg.overwrites; i++) {
+            if (!is_dead(&seg, &subs[i], i)) {
+                continue;
+            }
+            CDG_STATS_COUNT(cdg_state->stats, packets);
+            CDG_STATS_COUNT(cdg_state->stats, dead);
+
+            size_t done = cdg_decode_range(subs + run, i - run, cdg_state);
+            if (done != i - run) {
+                return run + done;
+            }
+            run = i + 1;
+        }
+
+        size_t done = cdg_decode_range(subs + run, seg.end - run, cdg_state);
+        if (done != seg.end - run) {
+            return run + done;
+        }
+        start = seg.end;
+    }
+
+    return n;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Fast-forwarding: decoding a range of packets when only the state at the end
+ * of the range will be looked at, such as between two frames of a video or
+ * when seeking. Packets whose effect is overwritten before the end of the
+ * range are skipped.
+ */
+
+#ifndef CDG_FORWARD_H
+#define CDG_FORWARD_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+/*
+ * Works like cdg_decode_range, and leaves the same screen, palette and scroll
+ * state behind. Packets are skipped when a later packet in the range fully
+ * overwrites what they wrote: tiles and presets covered by later tile blocks
+ * or presets, and palette, transparency and scroll offset changes followed
+ * by another of the same kind. Everything changed by a skipped packet is
+ * changed again later, so the dirty area still covers all changes.
+ *
+ * Scrolls that move the screen split the range, and nothing is skipped
+ * across them. Returns the number of packets consumed, which is less than n
+ * only if processing a packet failed.
+ */
+size_t cdg_fast_forward(const SubCode *subs, size_t n, cdg *cdg_state);
+
+#endif // CDG_FORWARD_H
@@ -0,0 +1,336 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_index.h"
+#include "cdg_forward.h"
+
+#include <stdlib.h> // malloc, realloc, free
+#include <stdio.h> // fopen, fread, fwrite
+#include <string.h> // memcmp
+#include <errno.h> // errno
+#include <stdint.h> // uintmax_t
+#include <sys/stat.h> // fstat
+
+// A memory preset shortly after a snapshot does not get its own
+#define MIN_PRESET_DISTANCE CDG_PACKETS_PER_SECOND
+
+// File format: magic, then the packet and snapshot counts, then the snapshots
+static const char index_magic[8] = { 'C', 'D', 'G', 'I', 'N', 'D', 'X', '2' };
+
+void cdg_snapshot_take(const cdg *cdg_state, size_t packet, CDG_Snapshot *snapshot)
+{
+    snapshot->packet = packet;
+    memcpy(snapshot->color_table, cdg_state->color_table, sizeof(snapshot->color_table));
+    snapshot->transparent_color = cdg_state->transparent_color;
+    snapshot->origin_x = cdg_state->origin_x / CDG_TILE_WIDTH;
+    snapshot->origin_y = cdg_state->origin_y / CDG_TILE_HEIGHT;
+    snapshot->offset_x = cdg_state->offset_x;
+    snapshot->offset_y = cdg_state->offset_y;
+
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < CDG_SCREEN_WIDTH / 2; x++) {
+            snapshot->pixels[y][x] = (cdg_state->pixels[y][2 * x] & 0x0F)
+                                   | (cdg_state->pixels[y][2 * x + 1] << 4);
+        }
+    }
+}
+
+void cdg_snapshot_restore(cdg *cdg_state, const CDG_Snapshot *snapshot)
+{
+    memcpy(cdg_state->color_table, snapshot->color_table, sizeof(cdg_state->color_table));
+    cdg_state->transparent_color = snapshot->transparent_color;
+    cdg_state->origin_x = snapshot->origin_x * CDG_TILE_WIDTH;
+    cdg_state->origin_y = snapshot->origin_y * CDG_TILE_HEIGHT;
+    cdg_state->offset_x = snapshot->offset_x;
+    cdg_state->offset_y = snapshot->offset_y;
+
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < CDG_SCREEN_WIDTH / 2; x++) {
+            cdg_state->pixels[y][2 * x] = snapshot->pixels[y][x] & 0x0F;
+            cdg_state->pixels[y][2 * x + 1] = snapshot->pixels[y][x] >> 4;
+        }
+    }
+
+    cdg_dirty_all(cdg_state);
+}
+
+// Appends a snapshot of the state, growing the array as needed
+static int add_snapshot(CDG_Index *index, size_t *capacity, const cdg *cdg_state, size_t packet)
+{
+    if (index->count == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+        CDG_Snapshot *snapshots = realloc(index->snapshots, new_capacity * sizeof(CDG_Snapshot));
+        if (snapshots == NULL) {
+            return -1;
+        }
+        index->snapshots = snapshots;
+        *capacity = new_capacity;
+    }
+
+    cdg_snapshot_take(cdg_state, packet, &index->snapshots[index->count++]);
+    return 0;
+}
+
+int cdg_index_build(CDG_Index *index, const SubCode *subs, size_t n, size_t interval)
+{
+    index->packets = n;
+    index->count = 0;
+    index->snapshots = NULL;
+    size_t capacity = 0;
+
+    cdg cdg_state;
+    cdg_init(&cdg_state);
+
+    if (add_snapshot(index, &capacity, &cdg_state, 0) != 0) {
+        return -1;
+    }
+    size_t last = 0;
+    int preset = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        // Packet i has not been processed yet, so this is the state before it
+        if ((interval != 0 && i - last >= interval)
+                || (preset && i - last >= MIN_PRESET_DISTANCE)) {
+            if (add_snapshot(index, &capacity, &cdg_state, i) != 0) {
+                cdg_index_free(index);
+                return -1;
+            }
+            last = i;
+        }
+
+        CDG_Packet packet = cdg_parse_packet(&subs[i]);
+        // Everything before a memory preset is wiped out by it, which makes
+        // the state right after it a good place to resume from
+        preset = packet.type == MEMORY_PRESET;
+        cdg_process_packet(&packet, &cdg_state);
+    }
+
+    return 0;
+}
+
+void cdg_index_free(CDG_Index *index)
+{
+    free(index->snapshots);
+    index->snapshots = NULL;
+    index->count = 0;
+}
+
+int cdg_seek(cdg *cdg_state, const CDG_Index *index, const SubCode *subs, size_t packet)
+{
+    if (packet > index->packets || index->count == 0) {
+        return 1;
+    }
+
+    // Find the last snapshot at or before the packet
+    size_t low = 0;
+    size_t high = index->count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (index->snapshots[mid].packet <= packet) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    const CDG_Snapshot *snapshot = &index->snapshots[low];
+    cdg_snapshot_restore(cdg_state, snapshot);
+
+    // Only the state at the target matters, so skip what is overwritten
+    size_t remaining = packet - snapshot->packet;
+    if (cdg_fast_forward(subs + snapshot->packet, remaining, cdg_state) != remaining) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Integers are stored as 8 bytes, least significant first
+ */
+static int write_size(FILE *file, size_t value)
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (unsigned char)((unsigned long long)value >> (8 * i));
+    }
+    return fwrite(bytes, sizeof(bytes), 1, file) == 1 ? 0 : -1;
+}
+
+static int read_size(FILE *file, size_t *value)
+{
+    unsigned char bytes[8];
+    if (fread(bytes, sizeof(bytes), 1, file) != 1) {
+        return -1;
+    }
+    unsigned long long result = 0;
+    for (int i = 0; i < 8; i++) {
+        result |= (unsigned long long)bytes[i] << (8 * i);
+    }
+    *value = (size_t)result;
+    return 0;
+}
+
+// Bytes of the fields of a snapshot stored between its packet and pixels
+#define SNAPSHOT_FIELDS (16 * 3 + 5)
+
+// Bytes taken by a snapshot in a file
+#define SNAPSHOT_SIZE (8 + SNAPSHOT_FIELDS + sizeof(((CDG_Snapshot *)0)->pixels))
+
+static int write_snapshot(FILE *file, const CDG_Snapshot *snapshot)
+{
+    unsigned char fields[SNAPSHOT_FIELDS];
+    for (int i = 0; i < 16; i++) {
+        fields[3 * i] = snapshot->color_table[i].red;
+        fields[3 * i + 1] = snapshot->color_table[i].green;
+        fields[3 * i + 2] = snapshot->color_table[i].blue;
+    }
+    fields[16 * 3] = snapshot->transparent_color;
+    fields[16 * 3 + 1] = snapshot->origin_x;
+    fields[16 * 3 + 2] = snapshot->origin_y;
+    fields[16 * 3 + 3] = snapshot->offset_x;
+    fields[16 * 3 + 4] = snapshot->offset_y;
+
+    if (write_size(file, snapshot->packet) != 0
+            || fwrite(fields, sizeof(fields), 1, file) != 1
+            || fwrite(snapshot->pixels, sizeof(snapshot->pixels), 1, file) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int read_snapshot(FILE *file, CDG_Snapshot *snapshot)
+{
+    unsigned char fields[SNAPSHOT_FIELDS];
+    if (read_size(file, &snapshot->packet) != 0
+            || fread(fields, sizeof(fields), 1, file) != 1
+            || fread(snapshot->pixels, sizeof(snapshot->pixels), 1, file) != 1) {
+        return -1;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        snapshot->color_table[i].red = fields[3 * i] & 0x0F;
+        snapshot->color_table[i].green = fields[3 * i + 1] & 0x0F;
+        snapshot->color_table[i].blue = fields[3 * i + 2] & 0x0F;
+    }
+    snapshot->transparent_color = fields[16 * 3] & 0x0F;
+    snapshot->origin_x = fields[16 * 3 + 1];
+    snapshot->origin_y = fields[16 * 3 + 2];
+    snapshot->offset_x = fields[16 * 3 + 3];
+    snapshot->offset_y = fields[16 * 3 + 4];
+
+    if (snapshot->origin_x >= CDG_TILES_X || snapshot->origin_y >= CDG_TILES_Y
+            || snapshot->offset_x >= CDG_TILE_WIDTH || snapshot->offset_y >= CDG_TILE_HEIGHT) {
+        return -1;
+    }
+    return 0;
+}
+
+int cdg_index_save(const CDG_Index *index, const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    if (fwrite(index_magic, sizeof(index_magic), 1, file) != 1
+            || write_size(file, index->packets) != 0
+            || write_size(file, index->count) != 0) {
+        result = -1;
+    }
+    for (size_t i = 0; result == 0 && i < index->count; i++) {
+        result = write_snapshot(file, &index->snapshots[i]);
+    }
+
+    int err = errno;
+    if (fclose(file) != 0 && result == 0) {
+        return -1;
+    }
+    errno = err;
+    return result;
+}
+
+int cdg_index_load(CDG_Index *index, const char *filename)
+{
+    index->packets = 0;
+    index->count = 0;
+    index->snapshots = NULL;
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char magic[sizeof(index_magic)];
+    size_t packets;
+    size_t count;
+    if (fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, index_magic, sizeof(magic)) != 0
+            || read_size(file, &packets) != 0
+            || read_size(file, &count) != 0
+            || count == 0 || count > packets + 1) {
+        fclose(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The count is only trusted as far as the file holds that many snapshots,
+    // which also keeps the allocation below from overflowing
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        int err = errno;
+        fclose(file);
+        errno = err;
+        return -1;
+    }
+    size_t header = sizeof(index_magic) + 16;
+    if ((uintmax_t)st.st_size < header || count > ((uintmax_t)st.st_size - header) / SNAPSHOT_SIZE) {
+        fclose(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    CDG_Snapshot *snapshots = malloc(count * sizeof(CDG_Snapshot));
+    if (snapshots == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        // Snapshots must be in order, start at the first packet, and lie
+        // within the stream
+        if (read_snapshot(file, &snapshots[i]) != 0
+                || (i == 0 && snapshots[i].packet != 0)
+                || (i > 0 && snapshots[i].packet <= snapshots[i - 1].packet)
+                || snapshots[i].packet > packets) {
+            free(snapshots);
+            fclose(file);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    fclose(file);
+
+    index->packets = packets;
+    index->count = count;
+    index->snapshots = snapshots;
+    return 0;
+}
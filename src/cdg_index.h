@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keyframe index for seeking. The index holds snapshots of the decoder state
+ * at regular intervals and at full screen clears, so that seeking only has to
+ * replay the packets since the nearest earlier snapshot.
+ */
+
+#ifndef CDG_INDEX_H
+#define CDG_INDEX_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+/*
+ * The state of the screen before a given packet is processed. Pixels are
+ * stored as they are laid out in the state, wrapped around the origin, and
+ * packed two to a byte with the left pixel in the lower nibble.
+ */
+typedef struct {
+    size_t packet; // Index of the first packet not reflected in the snapshot
+    CDG_RGB color_table[16];
+    unsigned char transparent_color;
+    unsigned char origin_x;
+    unsigned char origin_y;
+    unsigned char offset_x;
+    unsigned char offset_y;
+    unsigned char pixels[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH / 2];
+} CDG_Snapshot;
+
+typedef struct {
+    size_t packets;          // Number of packets in the indexed stream
+    size_t count;            // Number of snapshots, ordered by packet
+    CDG_Snapshot *snapshots; // Always starts with the initial state
+} CDG_Index;
+
+// Takes a snapshot of the given state, recording that it was taken before
+// the given packet
+void cdg_snapshot_take(const cdg *cdg_state, size_t packet, CDG_Snapshot *snapshot);
+
+// Restores the screen from a snapshot and marks it all as dirty. The log of
+// the state is left as it is.
+void cdg_snapshot_restore(cdg *cdg_state, const CDG_Snapshot *snapshot);
+
+// Builds an index over n packets by decoding them, with a snapshot at least
+// every interval packets and at memory presets. An interval of 0 takes
+// snapshots at memory presets only. Returns 0 on success and -1 if out of
+// memory.
+int cdg_index_build(CDG_Index *index, const SubCode *subs, size_t n, size_t interval);
+
+// Frees the snapshots of an index
+void cdg_index_free(CDG_Index *index);
+
+// Brings the state to where it would be after processing the first packet
+// packets of subs, starting from the nearest snapshot in the index. Returns
+// 0 on success and 1 if the packet is past the end of the indexed stream or
+// processing fails.
+int cdg_seek(cdg *cdg_state, const CDG_Index *index, const SubCode *subs, size_t packet);
+
+// Writes an index to a file, typically next to the .cdg file, and reads it
+// back. Both return 0 on success and -1 on failure, in which case errno is
+// set. Loading fails with EINVAL if the file is not an index.
+int cdg_index_save(const CDG_Index *index, const char *filename);
+int cdg_index_load(CDG_Index *index, const char *filename);
+
+#endif // CDG_INDEX_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_log.h"
+
+#include <stdarg.h> // va_list and friends
+#include <string.h> // memcpy
+
+static const char *level_name(int level)
+{
+    switch (level) {
+        case CDG_LOG_ERROR:
+            return "ERROR";
+        case CDG_LOG_WARN:
+            return "WARN";
+        case CDG_LOG_INFO:
+            return "INFO";
+        case CDG_LOG_TRACE:
+            return "TRACE";
+        default:
+            return "?";
+    }
+}
+
+void cdg_log_init(CDG_Log *log, int level, CDG_LogCallback callback, void *user)
+{
+    log->level = level;
+    log->callback = callback;
+    log->user = user;
+    log->ring = NULL;
+}
+
+/*
+ * Each entry works like a sequence lock: the writer clears the sequence
+ * number, fills in the entry and then publishes its number. A reader that
+ * sees the same non-zero number before and after copying an entry got a
+ * complete message.
+ */
+static void ring_push(CDG_LogRing *ring, int level, const char *message)
+{
+    unsigned long ticket = atomic_fetch_add_explicit(&ring->next, 1, memory_order_relaxed);
+    CDG_LogEntry *entry = &ring->entries[ticket % CDG_LOG_RING_ENTRIES];
+
+    atomic_store_explicit(&entry->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    entry->level = level;
+    snprintf(entry->message, sizeof(entry->message), "%s", message);
+
+    atomic_store_explicit(&entry->sequence, ticket + 1, memory_order_release);
+}
+
+void cdg_log_write(CDG_Log *log, int level, const char *fmt, ...)
+{
+    if (log == NULL || level > log->level) {
+        return;
+    }
+
+    char message[CDG_LOG_MESSAGE_LENGTH];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    if (log->callback != NULL) {
+        log->callback(log->user, level, message);
+    }
+    if (log->ring != NULL) {
+        ring_push(log->ring, level, message);
+    }
+}
+
+void cdg_log_stream(void *user, int level, const char *message)
+{
+    fprintf((FILE *)user, "[%s] %s\n", level_name(level), message);
+}
+
+void cdg_log_ring_init(CDG_LogRing *ring)
+{
+    atomic_init(&ring->next, 0);
+    for (int i = 0; i < CDG_LOG_RING_ENTRIES; i++) {
+        atomic_init(&ring->entries[i].sequence, 0);
+    }
+}
+
+void cdg_log_ring_dump(CDG_LogRing *ring, FILE *out)
+{
+    unsigned long next = atomic_load_explicit(&ring->next, memory_order_acquire);
+    unsigned long first = next > CDG_LOG_RING_ENTRIES ? next - CDG_LOG_RING_ENTRIES : 0;
+
+    for (unsigned long ticket = first; ticket < next; ticket++) {
+        CDG_LogEntry *entry = &ring->entries[ticket % CDG_LOG_RING_ENTRIES];
+
+        unsigned long before = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+        if (before != ticket + 1) {
+            continue;
+        }
+        int level = entry->level;
+        char message[CDG_LOG_MESSAGE_LENGTH];
+        memcpy(message, entry->message, sizeof(message));
+        atomic_thread_fence(memory_order_acquire);
+        unsigned long after = atomic_load_explicit(&entry->sequence, memory_order_relaxed);
+        if (after != before) {
+            continue;
+        }
+
+        message[sizeof(message) - 1] = '\0';
+        fprintf(out, "%lu [%s] %s\n", ticket, level_name(level), message);
+    }
+}
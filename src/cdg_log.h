@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Logging for the decoder. Nothing is logged unless a CDG_Log is attached to
+ * the state, and messages below CDG_LOG_LEVEL are compiled out entirely.
+ */
+
+#ifndef CDG_LOG_H
+#define CDG_LOG_H
+
+#include <stdio.h> // FILE
+#include <stdatomic.h> // atomic_ulong
+
+/*
+ * Log levels, from least to most verbose
+ */
+#define CDG_LOG_ERROR 1
+#define CDG_LOG_WARN 2
+#define CDG_LOG_INFO 3
+#define CDG_LOG_TRACE 4
+
+/*
+ * The most verbose level compiled in. Tracing is only available in debug
+ * builds unless asked for explicitly with -DCDG_LOG_LEVEL=4.
+ */
+#ifndef CDG_LOG_LEVEL
+#ifdef NDEBUG
+#define CDG_LOG_LEVEL CDG_LOG_INFO
+#else
+#define CDG_LOG_LEVEL CDG_LOG_TRACE
+#endif
+#endif
+
+/*
+ * Ring buffer keeping the latest messages in memory, so that they can be
+ * looked at after the fact. Writing to it never blocks, and several logs may
+ * share one ring.
+ */
+#define CDG_LOG_RING_ENTRIES 256
+#define CDG_LOG_MESSAGE_LENGTH 96
+
+typedef struct {
+    // 0 while the entry is being written, otherwise the number of the
+    // message in the ring plus one
+    atomic_ulong sequence;
+    int level;
+    char message[CDG_LOG_MESSAGE_LENGTH];
+} CDG_LogEntry;
+
+typedef struct {
+    atomic_ulong next; // Number of messages ever written
+    CDG_LogEntry entries[CDG_LOG_RING_ENTRIES];
+} CDG_LogRing;
+
+// Called for every message that passes the level filter
+typedef void (*CDG_LogCallback)(void *user, int level, const char *message);
+
+typedef struct {
+    int level;                // Messages more verbose than this are dropped
+    CDG_LogCallback callback; // May be NULL
+    void *user;               // Passed on to the callback
+    CDG_LogRing *ring;        // May be NULL
+} CDG_Log;
+
+// Sets up a log with the given level and callback, and no ring buffer
+void cdg_log_init(CDG_Log *log, int level, CDG_LogCallback callback, void *user);
+
+// Formats and delivers a message. Use the macros below instead.
+void cdg_log_write(CDG_Log *log, int level, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+// Callback writing each message as a line to the FILE * given as user data
+void cdg_log_stream(void *user, int level, const char *message);
+
+// Empties a ring buffer
+void cdg_log_ring_init(CDG_LogRing *ring);
+
+// Writes the messages in the ring to the given stream, oldest first. Messages
+// being written at the same time are skipped.
+void cdg_log_ring_dump(CDG_LogRing *ring, FILE *out);
+
+/*
+ * Logging macros. log may be NULL, in which case nothing happens.
+ */
+#define CDG_LOG_AT(log, lvl, ...) \
+    do { \
+        if ((lvl) <= CDG_LOG_LEVEL && (log) != NULL && (lvl) <= (log)->level) { \
+            cdg_log_write((log), (lvl), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define CDG_ERROR(log, ...) CDG_LOG_AT(log, CDG_LOG_ERROR, __VA_ARGS__)
+#define CDG_WARN(log, ...) CDG_LOG_AT(log, CDG_LOG_WARN, __VA_ARGS__)
+#define CDG_INFO(log, ...) CDG_LOG_AT(log, CDG_LOG_INFO, __VA_ARGS__)
+#if CDG_LOG_LEVEL >= CDG_LOG_TRACE
+#define CDG_TRACE(log, ...) CDG_LOG_AT(log, CDG_LOG_TRACE, __VA_ARGS__)
+#else
+#define CDG_TRACE(log, ...) ((void)0)
+#endif
+
+#endif // CDG_LOG_H
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_pack.h"
+#include "cdg_stats.h"
+
+#include <stdlib.h> // malloc, free
+#include <stdio.h> // fopen, fwrite
+#include <string.h> // memcpy, memcmp, memset
+#include <errno.h> // errno
+
+static const char pack_magic[8] = { 'C', 'D', 'G', 'P', 'A', 'C', 'K', '1' };
+
+#define HEADER_SIZE (sizeof(pack_magic) + 4 * 8)
+#define ENTRY_SIZE (2 * 8)
+// Instruction and data bytes
+#define RECORD_DATA 17
+// A gap of up to 64 bits needs at most 10 bytes
+#define MAX_GAP_BYTES 10
+
+static void put_size(unsigned char *dst, size_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        dst[i] = (unsigned char)((unsigned long long)value >> (8 * i));
+    }
+}
+
+static size_t get_size(const unsigned char *src)
+{
+    unsigned long long result = 0;
+    for (int i = 0; i < 8; i++) {
+        result |= (unsigned long long)src[i] << (8 * i);
+    }
+    return (size_t)result;
+}
+
+static size_t put_gap(unsigned char *dst, size_t gap)
+{
+    size_t length = 0;
+    while (gap >= 0x80) {
+        dst[length++] = (gap & 0x7F) | 0x80;
+        gap >>= 7;
+    }
+    dst[length++] = gap;
+    return length;
+}
+
+/*
+ * Reads a gap at the given offset and moves the offset past it. Returns -1 if
+ * it runs past the end or is longer than any gap can be.
+ */
+static int get_gap(const unsigned char *src, size_t size, size_t *offset, size_t *gap)
+{
+    size_t result = 0;
+    for (int i = 0; i < MAX_GAP_BYTES && *offset < size; i++) {
+        unsigned char byte = src[(*offset)++];
+        result |= (size_t)(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            *gap = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int cdg_pack_encode(const SubCode *subs, size_t n, size_t interval,
+                    unsigned char **out, size_t *size)
+{
+    size_t live = 0;
+    for (size_t i = 0; i < n; i++) {
+        live += cdg_contains_data(&subs[i]);
+    }
+    size_t entries = interval > 0 && n > 0 ? (n - 1) / interval + 1 : 0;
+
+    // Allocate for the longest gaps possible, and give back the rest after
+    size_t capacity = HEADER_SIZE + entries * ENTRY_SIZE + live * (MAX_GAP_BYTES + RECORD_DATA);
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memcpy(buffer, pack_magic, sizeof(pack_magic));
+    put_size(buffer + sizeof(pack_magic), n);
+    put_size(buffer + sizeof(pack_magic) + 8, live);
+    put_size(buffer + sizeof(pack_magic) + 16, entries);
+    put_size(buffer + sizeof(pack_magic) + 24, interval);
+
+    unsigned char *index = buffer + HEADER_SIZE;
+    unsigned char *records = index + entries * ENTRY_SIZE;
+    size_t offset = 0;
+    size_t base = 0; // The packet after the last record
+    size_t entry = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (entry < entries && i == entry * interval) {
+            put_size(index + entry * ENTRY_SIZE, base);
+            put_size(index + entry * ENTRY_SIZE + 8, offset);
+            entry++;
+        }
+        if (!cdg_contains_data(&subs[i])) {
+            continue;
+        }
+
+        offset += put_gap(records + offset, i - base);
+        records[offset++] = cdg_get_instruction(&subs[i]);
+        for (int j = 0; j < 16; j++) {
+            records[offset++] = subs[i].data[j] & CDG_MASK;
+        }
+        base = i + 1;
+    }
+
+    *size = HEADER_SIZE + entries * ENTRY_SIZE + offset;
+    unsigned char *shrunk = realloc(buffer, *size);
+    *out = shrunk != NULL ? shrunk : buffer;
+    return 0;
+}
+
+int cdg_pack_save(const SubCode *subs, size_t n, size_t interval, const char *filename)
+{
+    unsigned char *buffer;
+    size_t size;
+    if (cdg_pack_encode(subs, n, interval, &buffer, &size) != 0) {
+        return -1;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        int err = errno;
+        free(buffer);
+        errno = err;
+        return -1;
+    }
+
+    int result = fwrite(buffer, 1, size, file) == size ? 0 : -1;
+    int err = errno;
+    free(buffer);
+    if (fclose(file) != 0 && result == 0) {
+        return -1;
+    }
+    errno = err;
+    return result;
+}
+
+int cdg_pack_load(CDG_Pack *pack, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    memset(pack, 0, sizeof(*pack));
+
+    if (size < HEADER_SIZE || memcmp(bytes, pack_magic, sizeof(pack_magic)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t count = get_size(bytes + sizeof(pack_magic));
+    size_t live = get_size(bytes + sizeof(pack_magic) + 8);
+    size_t entries = get_size(bytes + sizeof(pack_magic) + 16);
+    size_t interval = get_size(bytes + sizeof(pack_magic) + 24);
+
+    // Every record takes at least 18 bytes and every entry 16, which bounds
+    // the counts before they are multiplied
+    size_t rest = size - HEADER_SIZE;
+    if (live > count || live > rest / (RECORD_DATA + 1) || entries > rest / ENTRY_SIZE
+            || (entries > 0 && (interval == 0 || count == 0 || entries != (count - 1) / interval + 1))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const unsigned char *index = bytes + HEADER_SIZE;
+    const unsigned char *records = index + entries * ENTRY_SIZE;
+    size_t records_size = rest - entries * ENTRY_SIZE;
+
+    // Walk all records once, checking the index entries on the way
+    size_t offset = 0;
+    size_t base = 0;
+    size_t entry = 0;
+    for (size_t record = 0; record <= live; record++) {
+        size_t packet = count;
+        size_t start = offset;
+        if (record < live) {
+            size_t gap;
+            if (get_gap(records, records_size, &offset, &gap) != 0
+                    || gap >= count - base || records_size - offset < RECORD_DATA) {
+                errno = EINVAL;
+                return -1;
+            }
+            packet = base + gap;
+            offset += RECORD_DATA;
+        }
+
+        // Entries for the packets up to and including this record start here
+        for (; entry < entries && entry * interval <= packet; entry++) {
+            if (get_size(index + entry * ENTRY_SIZE) != base
+                    || get_size(index + entry * ENTRY_SIZE + 8) != start) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
+        base = packet + 1;
+    }
+    if (offset != records_size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pack->count = count;
+    pack->live = live;
+    pack->entries = entries;
+    pack->interval = interval;
+    pack->index = index;
+    pack->records = records;
+    pack->records_size = records_size;
+    return 0;
+}
+
+int cdg_pack_open(CDG_Pack *pack, const char *filename)
+{
+    CDG_File file;
+    if (cdg_file_open(&file, filename) != 0) {
+        memset(pack, 0, sizeof(*pack));
+        return -1;
+    }
+
+    if (cdg_pack_load(pack, file.map, file.map_size) != 0) {
+        cdg_file_close(&file);
+        errno = EINVAL;
+        return -1;
+    }
+    pack->file = file;
+    return 0;
+}
+
+void cdg_pack_close(CDG_Pack *pack)
+{
+    cdg_file_close(&pack->file);
+}
+
+// Reads the gap of the record at the cursor, if there is one left
+static void read_next(CDG_PackCursor *cursor, size_t base)
+{
+    const CDG_Pack *pack = cursor->pack;
+    size_t gap;
+    if (cursor->offset >= pack->records_size
+            || get_gap(pack->records, pack->records_size, &cursor->offset, &gap) != 0) {
+        cursor->next = pack->count;
+        return;
+    }
+    cursor->next = base + gap;
+}
+
+// Builds the packet of the record at the cursor
+static void record_packet(const CDG_PackCursor *cursor, SubCode *sub)
+{
+    const unsigned char *record = cursor->pack->records + cursor->offset;
+    memset(sub, 0, sizeof(*sub));
+    sub->command = CDG_COMMAND;
+    sub->instruction = record[0];
+    memcpy(sub->data, record + 1, sizeof(sub->data));
+}
+
+void cdg_pack_unpack(const CDG_Pack *pack, SubCode *subs)
+{
+    memset(subs, 0, pack->count * sizeof(SubCode));
+
+    CDG_PackCursor cursor;
+    for (cdg_pack_cursor_init(&cursor, pack); cursor.next < pack->count; ) {
+        record_packet(&cursor, &subs[cursor.next]);
+        cursor.offset += RECORD_DATA;
+        read_next(&cursor, cursor.next + 1);
+    }
+}
+
+void cdg_pack_cursor_init(CDG_PackCursor *cursor, const CDG_Pack *pack)
+{
+    cursor->pack = pack;
+    cursor->position = 0;
+    cursor->offset = 0;
+    read_next(cursor, 0);
+}
+
+void cdg_pack_seek(CDG_PackCursor *cursor, size_t packet)
+{
+    const CDG_Pack *pack = cursor->pack;
+    if (packet > pack->count) {
+        packet = pack->count;
+    }
+
+    // Start over from the nearest index entry, unless the cursor is closer
+    if (pack->entries > 0 && (packet < cursor->position
+            || packet / pack->interval > cursor->position / pack->interval)) {
+        size_t entry = packet / pack->interval;
+        if (entry >= pack->entries) {
+            entry = pack->entries - 1;
+        }
+        cursor->offset = get_size(pack->index + entry * ENTRY_SIZE + 8);
+        read_next(cursor, get_size(pack->index + entry * ENTRY_SIZE));
+    } else if (packet < cursor->position) {
+        cdg_pack_cursor_init(cursor, pack);
+    }
+
+    while (cursor->next < packet) {
+        cursor->offset += RECORD_DATA;
+        read_next(cursor, cursor->next + 1);
+    }
+    cursor->position = packet;
+}
+
+size_t cdg_pack_decode(CDG_PackCursor *cursor, size_t n, cdg *cdg_state)
+{
+    size_t start = cursor->position;
+    size_t left = cursor->pack->count - start;
+    size_t target = start + (n < left ? n : left);
+    size_t records = 0;
+
+    while (cursor->next < target) {
+        SubCode sub;
+        record_packet(cursor, &sub);
+        if (cdg_decode_range(&sub, 1, cdg_state) != 1) {
+            cursor->position = cursor->next;
+            return cursor->position - start;
+        }
+        records++;
+        cursor->offset += RECORD_DATA;
+        read_next(cursor, cursor->next + 1);
+    }
+
+    // The packets between the records were never there to be seen
+    CDG_STATS_ADD(cdg_state->stats, packets, target - start - records);
+    CDG_STATS_ADD(cdg_state->stats, empty, target - start - records);
+
+    cursor->position = target;
+    return target - start;
+}
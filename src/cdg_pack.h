@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A compact container for CD+G streams. Only packets with CD+G data are
+ * stored, as their instruction and 16 data bytes, and the empty packets
+ * between them as a count. Parity bytes and the bits of other subchannels
+ * are dropped, none of which the decoder looks at, so a stream decodes to
+ * the same screen either way.
+ *
+ * Layout, with all integers 8 bytes and least significant byte first:
+ *
+ *   magic        "CDGPACK1"
+ *   count        packets in the stream, empty ones included
+ *   live         records, one per packet with CD+G data
+ *   entries      seek index entries, 0 if there is no index
+ *   interval     packets between index entries
+ *   index        entries times (base, offset) pairs
+ *   records      live times (gap, instruction, 16 data bytes)
+ *
+ * The gap of a record is the number of empty packets before it, stored 7 bits
+ * to a byte with the high bit set on all but the last byte. Index entry k
+ * lets decoding start at packet k * interval: it holds the offset into the
+ * records of the first record at or after that packet, and the packet right
+ * after the record before it, which its gap counts from.
+ */
+
+#ifndef CDG_PACK_H
+#define CDG_PACK_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+#include "cdg_file.h"
+
+typedef struct {
+    size_t count;    // Packets in the stream, empty ones included
+    size_t live;     // Packets with CD+G data, each stored as a record
+    size_t entries;  // Seek index entries
+    size_t interval; // Packets between seek index entries
+
+    const unsigned char *index;
+    const unsigned char *records;
+    size_t records_size;
+
+    CDG_File file; // The mapping, when opened with cdg_pack_open
+} CDG_Pack;
+
+/*
+ * A position in a pack, for decoding it in order
+ */
+typedef struct {
+    const CDG_Pack *pack;
+    size_t position; // Packets consumed
+    size_t offset;   // Where the instruction of the next record is
+    size_t next;     // The packet of the next record, or count if none is left
+} CDG_PackCursor;
+
+/*
+ * Packs n packets into a newly allocated buffer, with a seek index entry every
+ * interval packets, or none if interval is 0. The buffer is stored in out,
+ * and must be freed by the caller. Returns 0 on success and -1 with errno set
+ * on failure.
+ */
+int cdg_pack_encode(const SubCode *subs, size_t n, size_t interval,
+                    unsigned char **out, size_t *size);
+
+// Packs n packets into a file, like cdg_pack_encode
+int cdg_pack_save(const SubCode *subs, size_t n, size_t interval, const char *filename);
+
+/*
+ * Reads a pack from memory, which must stay valid while the pack is used. The
+ * whole pack is checked here, so that decoding can trust it. Returns 0 on
+ * success and -1 with errno set to EINVAL if it is not a valid pack.
+ */
+int cdg_pack_load(CDG_Pack *pack, const void *data, size_t size);
+
+// Maps a pack file into memory and reads it. Returns 0 on success and -1 with
+// errno set on failure.
+int cdg_pack_open(CDG_Pack *pack, const char *filename);
+
+// Unmaps a pack opened with cdg_pack_open
+void cdg_pack_close(CDG_Pack *pack);
+
+// Writes out all count packets of a pack as plain packets
+void cdg_pack_unpack(const CDG_Pack *pack, SubCode *subs);
+
+// Sets up a cursor at the first packet of a pack
+void cdg_pack_cursor_init(CDG_PackCursor *cursor, const CDG_Pack *pack);
+
+// Moves a cursor to the given packet, without decoding anything. With a seek
+// index this only skips the records since the nearest entry.
+void cdg_pack_seek(CDG_PackCursor *cursor, size_t packet);
+
+/*
+ * Decodes the next n packets of a pack, or as many as are left, into the
+ * state. Records are processed through cdg_decode_range, exactly like the
+ * packets they were made from. Returns the number of packets consumed, which
+ * is less than n only at the end of the pack or if processing a packet failed.
+ */
+size_t cdg_pack_decode(CDG_PackCursor *cursor, size_t n, cdg *cdg_state);
+
+#endif // CDG_PACK_H
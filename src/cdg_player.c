@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_player.h"
+#include "cdg_forward.h"
+
+// Skipping ahead further than this uses the index, if there is one
+#define SEEK_DISTANCE (10 * CDG_PACKETS_PER_SECOND)
+
+size_t cdg_packets_before(uint64_t usecs)
+{
+    return (usecs * CDG_PACKETS_PER_SECOND + 999999) / 1000000;
+}
+
+uint64_t cdg_packet_usecs(size_t packet)
+{
+    return (uint64_t)packet * 1000000 / CDG_PACKETS_PER_SECOND;
+}
+
+void cdg_player_init(CDG_Player *player, cdg *cdg_state, const SubCode *packets, size_t count)
+{
+    CDG_Log *log = cdg_state->log;
+    CDG_Stats *stats = cdg_state->stats;
+    cdg_init(cdg_state);
+    cdg_state->log = log;
+    cdg_state->stats = stats;
+
+    player->cdg_state = cdg_state;
+    player->packets = packets;
+    player->count = count;
+    player->position = 0;
+    player->index = NULL;
+}
+
+int cdg_player_update(CDG_Player *player, uint64_t usecs)
+{
+    size_t target = cdg_packets_before(usecs);
+    if (target > player->count) {
+        target = player->count;
+    }
+
+    // Jumps back, and long jumps ahead, are cheaper to do from a snapshot
+    if (player->index != NULL
+            && (target < player->position || target - player->position > SEEK_DISTANCE)) {
+        if (cdg_seek(player->cdg_state, player->index, player->packets, target) != 0) {
+            return 1;
+        }
+        player->position = target;
+        return 0;
+    }
+
+    if (target < player->position) {
+        // Without an index the only way back is to start over
+        CDG_Log *log = player->cdg_state->log;
+        CDG_Stats *stats = player->cdg_state->stats;
+        cdg_init(player->cdg_state);
+        player->cdg_state->log = log;
+        player->cdg_state->stats = stats;
+        player->position = 0;
+    }
+
+    // When the caller falls behind, this simply becomes a larger batch, in
+    // which only what is still visible at the target needs to be drawn
+    size_t due = target - player->position;
+    size_t applied = cdg_fast_forward(player->packets + player->position, due, player->cdg_state);
+    player->position += applied;
+
+    return applied == due ? 0 : 1;
+}
+
+int cdg_player_finished(const CDG_Player *player)
+{
+    return player->position == player->count;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Playback scheduling. A player tracks how far into a packet stream the
+ * decoder state is, and brings it up to date with a playback clock in one
+ * batch, so that a renderer can draw once per display refresh no matter how
+ * many packets were due since the last one.
+ */
+
+#ifndef CDG_PLAYER_H
+#define CDG_PLAYER_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#include "cdg.h"
+#include "cdg_index.h"
+
+typedef struct {
+    cdg *cdg_state;
+    const SubCode *packets;
+    size_t count;
+    size_t position;        // Number of packets applied to the state
+    const CDG_Index *index; // Used for seeking if set, may be NULL
+} CDG_Player;
+
+// Number of packets that start before the given time, counted exactly from
+// the 300 packets per second clock
+size_t cdg_packets_before(uint64_t usecs);
+
+// The time at which the given packet starts, rounded down
+uint64_t cdg_packet_usecs(size_t packet);
+
+// Sets up a player at the start of the stream. The state is reset.
+void cdg_player_init(CDG_Player *player, cdg *cdg_state, const SubCode *packets, size_t count);
+
+// Applies every packet due by the given time, which usually comes from the
+// audio position or a wall clock. Going back in time, or far ahead, restores
+// the nearest snapshot in the index first. Without an index, going back
+// replays from the start. Returns 0 on success
+// and 1 if processing a packet failed.
+int cdg_player_update(CDG_Player *player, uint64_t usecs);
+
+// Returns 1 once every packet has been applied
+int cdg_player_finished(const CDG_Player *player);
+
+#endif // CDG_PLAYER_H
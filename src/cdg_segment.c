@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_segment.h"
+
+#include <stdlib.h> // realloc, free
+#include <string.h> // memset
+#include <errno.h> // errno
+
+static int add_segment(CDG_Segments *segments, size_t begin, const cdg *scratch,
+                       unsigned char memory_color, unsigned char border_color)
+{
+    if (segments->count == segments->capacity) {
+        size_t capacity = segments->capacity == 0 ? 16 : segments->capacity * 2;
+        CDG_Segment *grown = realloc(segments->segments, capacity * sizeof(CDG_Segment));
+        if (grown == NULL) {
+            return -1;
+        }
+        segments->segments = grown;
+        segments->capacity = capacity;
+    }
+
+    CDG_Segment *segment = &segments->segments[segments->count++];
+    segment->begin = begin;
+    memcpy(segment->color_table, scratch->color_table, sizeof(segment->color_table));
+    segment->transparent_color = scratch->transparent_color;
+    segment->memory_color = memory_color;
+    segment->border_color = border_color;
+    segment->origin_x = scratch->origin_x;
+    segment->origin_y = scratch->origin_y;
+    segment->offset_x = scratch->offset_x;
+    segment->offset_y = scratch->offset_y;
+    return 0;
+}
+
+static int scan(CDG_Segments *segments, const SubCode *subs, size_t n, size_t min_length)
+{
+    // The palette and scroll position are tracked by processing only the
+    // packets that change them. The pixels of this state mean nothing.
+    cdg *scratch = malloc(sizeof(cdg));
+    if (scratch == NULL) {
+        return -1;
+    }
+    cdg_init(scratch);
+
+    // A fresh state is the same as one cleared to color 0
+    int result = add_segment(segments, 0, scratch, 0, 0);
+
+    // Whether a memory and a border preset were seen since the last packet
+    // that drew on the screen, and their colors
+    int memory_seen = 0;
+    int border_seen = 0;
+    unsigned char memory_color = 0;
+    unsigned char border_color = 0;
+
+    for (size_t i = 0; i < n && result == 0; i++) {
+        if (!cdg_contains_data(&subs[i])) {
+            continue;
+        }
+
+        switch (cdg_get_instruction(&subs[i])) {
+            case CDG_TILE_BLOCK:
+            case CDG_TILE_BLOCK_XOR:
+                memory_seen = 0;
+                border_seen = 0;
+                continue;
+            case CDG_SCROLL_PRESET:
+            case CDG_SCROLL_COPY:
+                memory_seen = 0;
+                border_seen = 0;
+                break;
+            case CDG_LOAD_COLORS_LOW:
+            case CDG_LOAD_COLORS_HIGH:
+            case CDG_DEFINE_TRANSPARENT:
+                break;
+            case CDG_MEMORY_PRESET:
+            case CDG_BORDER_PRESET: {
+                // Repeated memory presets parse as empty
+                CDG_Packet packet = cdg_parse_packet(&subs[i]);
+                if (packet.type == MEMORY_PRESET) {
+                    memory_seen = 1;
+                    memory_color = packet.data.color;
+                } else if (packet.type == BORDER_PRESET) {
+                    border_seen = 1;
+                    border_color = packet.data.color;
+                }
+
+                size_t begin = i + 1;
+                size_t last = segments->segments[segments->count - 1].begin;
+                if (memory_seen && border_seen && begin < n && begin - last >= min_length) {
+                    result = add_segment(segments, begin, scratch, memory_color, border_color);
+                }
+                continue;
+            }
+            default:
+                continue;
+        }
+
+        CDG_Packet packet = cdg_parse_packet(&subs[i]);
+        cdg_process_packet(&packet, scratch);
+    }
+
+    free(scratch);
+    return result;
+}
+
+int cdg_segments_find(CDG_Segments *segments, const SubCode *subs, size_t n, size_t min_length)
+{
+    memset(segments, 0, sizeof(*segments));
+
+    if (scan(segments, subs, n, min_length) != 0) {
+        cdg_segments_free(segments);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void cdg_segments_free(CDG_Segments *segments)
+{
+    free(segments->segments);
+    memset(segments, 0, sizeof(*segments));
+}
+
+void cdg_segment_start(const CDG_Segment *segment, cdg *cdg_state)
+{
+    CDG_Log *log = cdg_state->log;
+    CDG_Stats *stats = cdg_state->stats;
+    cdg_init(cdg_state);
+
+    memcpy(cdg_state->color_table, segment->color_table, sizeof(cdg_state->color_table));
+    cdg_state->transparent_color = segment->transparent_color;
+    cdg_state->origin_x = segment->origin_x;
+    cdg_state->origin_y = segment->origin_y;
+    cdg_state->offset_x = segment->offset_x;
+    cdg_state->offset_y = segment->offset_y;
+
+    // Between them, the presets write every pixel. The screen is dirty all
+    // over already, as it would be after them.
+    CDG_Packet packet;
+    packet.type = MEMORY_PRESET;
+    packet.data.color = segment->memory_color;
+    cdg_process_packet(&packet, cdg_state);
+    packet.type = BORDER_PRESET;
+    packet.data.color = segment->border_color;
+    cdg_process_packet(&packet, cdg_state);
+
+    cdg_state->log = log;
+    cdg_state->stats = stats;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Splitting a stream into segments that can be decoded independently, for
+ * decoding one long file on several threads. A memory preset and a border
+ * preset together cover every pixel, so right after them the screen no
+ * longer depends on any earlier tile. What remains of the state, the
+ * palette, the transparent color and the scroll position, is found by a
+ * cheap pass that only looks at the packets changing them.
+ *
+ * Decoding a segment from its starting state gives exactly the state that
+ * decoding the whole stream up to there would have.
+ */
+
+#ifndef CDG_SEGMENT_H
+#define CDG_SEGMENT_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+typedef struct {
+    size_t begin; // The first packet of the segment
+
+    // The state before the first packet
+    CDG_RGB color_table[16];
+    unsigned char transparent_color;
+    unsigned char memory_color;
+    unsigned char border_color;
+    int origin_x;
+    int origin_y;
+    int offset_x;
+    int offset_y;
+} CDG_Segment;
+
+typedef struct {
+    CDG_Segment *segments; // Ordered by packet, the first one begins at 0
+    size_t count;
+    size_t capacity;
+} CDG_Segments;
+
+/*
+ * Splits a stream at the points where the screen was just cleared. Segments
+ * are made at least min_length packets long, except the last one, by
+ * skipping the points that come too soon. A stream that is never cleared is
+ * one segment. Returns 0 on success and -1 with errno set if memory ran out,
+ * in which case there are no segments.
+ */
+int cdg_segments_find(CDG_Segments *segments, const SubCode *subs, size_t n, size_t min_length);
+
+// Frees the segments
+void cdg_segments_free(CDG_Segments *segments);
+
+// Sets up the state a segment starts from. The log and statistics of the
+// state are kept.
+void cdg_segment_start(const CDG_Segment *segment, cdg *cdg_state);
+
+#endif // CDG_SEGMENT_H
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_shm.h"
+#include "cdg_convert.h"
+
+#include <sys/mman.h> // shm_open, mmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // O_CREAT
+#include <unistd.h> // ftruncate, close
+#include <string.h> // memcpy, memcmp
+#include <errno.h> // errno
+
+// The sequence of a slot holding the complete frame with the given number
+#define COMPLETE(frame) (2 * (uint64_t)(frame) + 2)
+
+int cdg_shm_publisher_open(CDG_ShmPublisher *publisher, const char *name)
+{
+    publisher->ring = NULL;
+    if (strlen(name) >= sizeof(publisher->name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    // Start over, so that readers still holding an older ring keep it
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(CDG_ShmRing)) == 0) {
+        map = mmap(NULL, sizeof(CDG_ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        errno = err;
+        return -1;
+    }
+
+    // A new object is zeroed, so only the header needs filling in. The magic
+    // goes last, so that readers never see a half set up ring.
+    CDG_ShmRing *ring = map;
+    ring->size = sizeof(CDG_ShmRing);
+    atomic_init(&ring->published, 0);
+    atomic_init(&ring->finished, 0);
+    for (int i = 0; i < CDG_SHM_SLOTS; i++) {
+        atomic_init(&ring->slots[i].sequence, 0);
+    }
+    atomic_thread_fence(memory_order_release);
+    memcpy(ring->magic, CDG_SHM_MAGIC, sizeof(ring->magic));
+
+    publisher->ring = ring;
+    strcpy(publisher->name, name);
+    return 0;
+}
+
+void cdg_shm_publish(CDG_ShmPublisher *publisher, cdg *cdg_state, uint64_t usecs, uint64_t packet)
+{
+    CDG_ShmRing *ring = publisher->ring;
+    uint64_t number = atomic_load_explicit(&ring->published, memory_order_relaxed);
+    CDG_ShmFrame *frame = &ring->slots[number % CDG_SHM_SLOTS];
+
+    // Readers that see the odd sequence, or see it change, drop the frame
+    atomic_store_explicit(&frame->sequence, COMPLETE(number) - 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    frame->usecs = usecs;
+    frame->packet = packet;
+    memcpy(frame->color_table, cdg_state->color_table, sizeof(frame->color_table));
+    frame->transparent_color = cdg_state->transparent_color;
+    frame->palette_changed = cdg_palette_next(cdg_state);
+    memcpy(frame->dirty, cdg_state->dirty, sizeof(frame->dirty));
+    cdg_dirty_clear(cdg_state);
+    cdg_convert_indexed(cdg_state, frame->pixels, sizeof(frame->pixels[0]));
+
+    atomic_store_explicit(&frame->sequence, COMPLETE(number), memory_order_release);
+    atomic_store_explicit(&ring->published, number + 1, memory_order_release);
+}
+
+void cdg_shm_finish(CDG_ShmPublisher *publisher)
+{
+    atomic_store_explicit(&publisher->ring->finished, 1, memory_order_release);
+}
+
+void cdg_shm_publisher_close(CDG_ShmPublisher *publisher)
+{
+    if (publisher->ring != NULL) {
+        munmap(publisher->ring, sizeof(CDG_ShmRing));
+        shm_unlink(publisher->name);
+    }
+    publisher->ring = NULL;
+}
+
+int cdg_shm_reader_open(CDG_ShmReader *reader, const char *name)
+{
+    reader->ring = NULL;
+    reader->seen = 0;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0) {
+        if (st.st_size != sizeof(CDG_ShmRing)) {
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        map = mmap(NULL, sizeof(CDG_ShmRing), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+
+    const CDG_ShmRing *ring = map;
+    int valid = memcmp(ring->magic, CDG_SHM_MAGIC, sizeof(ring->magic)) == 0;
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || ring->size != sizeof(CDG_ShmRing)) {
+        munmap(map, sizeof(CDG_ShmRing));
+        errno = EINVAL;
+        return -1;
+    }
+
+    reader->ring = ring;
+    return 0;
+}
+
+const CDG_ShmFrame *cdg_shm_peek(const CDG_ShmReader *reader, uint64_t *sequence)
+{
+    const CDG_ShmRing *ring = reader->ring;
+    for (;;) {
+        uint64_t published = atomic_load_explicit(&ring->published, memory_order_acquire);
+        if (published == 0) {
+            return NULL;
+        }
+
+        const CDG_ShmFrame *frame = &ring->slots[(published - 1) % CDG_SHM_SLOTS];
+        *sequence = atomic_load_explicit(&frame->sequence, memory_order_acquire);
+        if (*sequence == COMPLETE(published - 1)) {
+            return frame;
+        }
+        // Overwritten already, so there is an even newer frame
+    }
+}
+
+int cdg_shm_valid(const CDG_ShmFrame *frame, uint64_t sequence)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&frame->sequence, memory_order_relaxed) == sequence;
+}
+
+// Adds the changes of the frames from first up to the one read to frame.
+// Returns 0 if any of them are gone from the ring.
+static int add_changes(const CDG_ShmRing *ring, uint64_t first, uint64_t end, CDG_ShmFrame *frame)
+{
+    if (end - first >= CDG_SHM_SLOTS) {
+        return 0;
+    }
+
+    for (uint64_t number = first; number < end; number++) {
+        const CDG_ShmFrame *older = &ring->slots[number % CDG_SHM_SLOTS];
+        uint64_t sequence = atomic_load_explicit(&older->sequence, memory_order_acquire);
+        if (sequence != COMPLETE(number)) {
+            return 0;
+        }
+
+        uint64_t dirty[CDG_TILES_Y];
+        memcpy(dirty, older->dirty, sizeof(dirty));
+        unsigned char palette_changed = older->palette_changed;
+        if (!cdg_shm_valid(older, sequence)) {
+            return 0;
+        }
+
+        for (int i = 0; i < CDG_TILES_Y; i++) {
+            frame->dirty[i] |= dirty[i];
+        }
+        frame->palette_changed |= palette_changed;
+    }
+    return 1;
+}
+
+int cdg_shm_read(CDG_ShmReader *reader, CDG_ShmFrame *frame)
+{
+    uint64_t sequence;
+    const CDG_ShmFrame *latest;
+    do {
+        latest = cdg_shm_peek(reader, &sequence);
+        if (latest == NULL) {
+            return 0;
+        }
+        if (reader->seen != 0 && sequence == COMPLETE(reader->seen - 1)) {
+            return 0; // Read already
+        }
+
+        // The sequence is copied too, but never changed, so the copy is
+        // consistent whenever the original was
+        memcpy(frame, latest, sizeof(*frame));
+    } while (!cdg_shm_valid(latest, sequence));
+
+    // The frame read is number sequence / 2 - 1
+    uint64_t number = sequence / 2 - 1;
+    if (reader->seen == 0 || !add_changes(reader->ring, reader->seen, number, frame)) {
+        for (int i = 0; i < CDG_TILES_Y; i++) {
+            frame->dirty[i] = (UINT64_C(1) << CDG_TILES_X) - 1;
+        }
+        frame->palette_changed = 1;
+    }
+
+    reader->seen = number + 1;
+    return 1;
+}
+
+int cdg_shm_finished(const CDG_ShmReader *reader)
+{
+    return atomic_load_explicit(&reader->ring->finished, memory_order_acquire);
+}
+
+void cdg_shm_reader_close(CDG_ShmReader *reader)
+{
+    if (reader->ring != NULL) {
+        munmap((void *)reader->ring, sizeof(CDG_ShmRing));
+    }
+    reader->ring = NULL;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Broadcasting frames to other processes through POSIX shared memory, so that
+ * several displays can show one song decoded once. A publisher writes frames
+ * into a ring of slots, and any number of readers map the ring and pick up
+ * the latest frame at their own pace.
+ *
+ * The publisher never waits for readers. Each slot has a sequence counter
+ * that is odd while the slot is being written, and a reader checks it before
+ * and after looking at a frame to find out whether the frame was overwritten
+ * under it. There must be only one publisher per ring.
+ */
+
+#ifndef CDG_SHM_H
+#define CDG_SHM_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <stdatomic.h>
+
+#include "cdg.h"
+
+// Frames kept in the ring. A reader that falls further behind than this
+// redraws the whole screen.
+#define CDG_SHM_SLOTS 8
+
+#define CDG_SHM_MAGIC "CDGSHM01"
+
+typedef struct {
+    // Twice the frame number plus one while the slot is being written, and
+    // plus two once it is complete. Zero while the slot was never written.
+    _Alignas(64) atomic_uint_fast64_t sequence;
+
+    uint64_t usecs;  // Playback time of the frame
+    uint64_t packet; // Number of packets applied
+
+    // The palette, and whether it or the transparent color changed since
+    // the previous frame
+    CDG_RGB color_table[16];
+    unsigned char transparent_color;
+    unsigned char palette_changed;
+
+    // The tiles changed since the previous frame, one word per tile row as
+    // in the cdg state
+    uint64_t dirty[CDG_TILES_Y];
+
+    // The screen as displayed, one color index per byte
+    unsigned char pixels[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+} CDG_ShmFrame;
+
+typedef struct {
+    char magic[8];
+    uint64_t size;     // Of the whole ring, to catch mismatched builds
+    _Alignas(64) atomic_uint_fast64_t published; // Frames written so far
+    atomic_int finished;                         // Set after the last frame
+    CDG_ShmFrame slots[CDG_SHM_SLOTS];
+} CDG_ShmRing;
+
+typedef struct {
+    CDG_ShmRing *ring;
+    char name[256];
+} CDG_ShmPublisher;
+
+typedef struct {
+    const CDG_ShmRing *ring;
+    uint64_t seen; // Frames published up to the last one read
+} CDG_ShmReader;
+
+/*
+ * Publisher side
+ */
+
+// Creates the ring under the given name, which starts with a slash as for
+// shm_open. An existing ring of that name is replaced. Returns 0 on success
+// and -1 with errno set on failure.
+int cdg_shm_publisher_open(CDG_ShmPublisher *publisher, const char *name);
+
+// Writes the screen of the state as the next frame. Its dirty rectangles and
+// palette change are taken out of the state and go with the frame.
+void cdg_shm_publish(CDG_ShmPublisher *publisher, cdg *cdg_state, uint64_t usecs, uint64_t packet);
+
+// Tells the readers that no more frames will come
+void cdg_shm_finish(CDG_ShmPublisher *publisher);
+
+// Unmaps the ring and removes its name. Readers that have it mapped keep it
+// until they close it.
+void cdg_shm_publisher_close(CDG_ShmPublisher *publisher);
+
+/*
+ * Reader side
+ */
+
+// Maps an existing ring. Returns 0 on success and -1 with errno set on
+// failure, with EINVAL if it is not a ring from this version of the library.
+int cdg_shm_reader_open(CDG_ShmReader *reader, const char *name);
+
+// Copies the latest frame if it is newer than the last one read. Its dirty
+// tiles and palette change are made to cover every frame since the last one
+// read, or the whole screen if some of them are gone from the ring. Returns
+// 1 if a frame was copied and 0 if there is nothing new.
+int cdg_shm_read(CDG_ShmReader *reader, CDG_ShmFrame *frame);
+
+// Returns the latest frame without copying it, and its sequence in
+// *sequence, or NULL if nothing has been published yet. The frame may be
+// overwritten at any time, so check it with cdg_shm_valid after using it.
+// The dirty tiles are only those of this frame.
+const CDG_ShmFrame *cdg_shm_peek(const CDG_ShmReader *reader, uint64_t *sequence);
+
+// Returns 1 if a frame from cdg_shm_peek was not overwritten since
+int cdg_shm_valid(const CDG_ShmFrame *frame, uint64_t sequence);
+
+// Returns 1 once the publisher has finished. Frames published before that
+// can still be read.
+int cdg_shm_finished(const CDG_ShmReader *reader);
+
+// Unmaps the ring
+void cdg_shm_reader_close(CDG_ShmReader *reader);
+
+#endif // CDG_SHM_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_stats.h"
+
+#include <string.h> // memset
+#include <time.h> // clock_gettime
+
+static const char *type_names[CDG_PACKET_TYPES] = {
+    "EMPTY",
+    "MEMORY_PRESET",
+    "BORDER_PRESET",
+    "TILE_BLOCK",
+    "TILE_BLOCK_XOR",
+    "LOAD_COLORS_LOW",
+    "LOAD_COLORS_HIGH",
+    "SCROLL_PRESET",
+    "SCROLL_COPY",
+    "DEFINE_TRANSPARENT",
+};
+
+void cdg_stats_init(CDG_Stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void cdg_stats_add(CDG_Stats *stats, const CDG_Stats *other)
+{
+    stats->packets += other->packets;
+    stats->empty += other->empty;
+    stats->repeats += other->repeats;
+    stats->invalid += other->invalid;
+    stats->dead += other->dead;
+
+    for (int type = 0; type < CDG_PACKET_TYPES; type++) {
+        stats->processed[type] += other->processed[type];
+        stats->nanoseconds[type] += other->nanoseconds[type];
+        for (int bucket = 0; bucket < CDG_STATS_BUCKETS; bucket++) {
+            stats->histogram[type][bucket] += other->histogram[type][bucket];
+        }
+    }
+}
+
+void cdg_stats_record(CDG_Stats *stats, packet_t type, uint64_t nanoseconds)
+{
+    if ((unsigned int)type >= CDG_PACKET_TYPES) {
+        return;
+    }
+
+    // The bucket is the position of the highest bit set
+    int bucket = 0;
+    while (bucket < CDG_STATS_BUCKETS - 1 && (nanoseconds >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+
+    stats->processed[type]++;
+    stats->nanoseconds[type] += nanoseconds;
+    stats->histogram[type][bucket]++;
+}
+
+uint64_t cdg_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int cdg_stats_write_json(const CDG_Stats *stats, FILE *out)
+{
+    fprintf(out, "{\"packets\": %llu, \"empty\": %llu, \"repeats\": %llu, \"invalid\": %llu, "
+            "\"dead\": %llu, \"types\": {",
+            (unsigned long long)stats->packets, (unsigned long long)stats->empty,
+            (unsigned long long)stats->repeats, (unsigned long long)stats->invalid,
+            (unsigned long long)stats->dead);
+
+    for (int type = 0; type < CDG_PACKET_TYPES; type++) {
+        fprintf(out, "%s\"%s\": {\"count\": %llu, \"nanoseconds\": %llu, \"histogram\": [",
+                type == 0 ? "" : ", ", type_names[type],
+                (unsigned long long)stats->processed[type],
+                (unsigned long long)stats->nanoseconds[type]);
+        for (int bucket = 0; bucket < CDG_STATS_BUCKETS; bucket++) {
+            fprintf(out, "%s%llu", bucket == 0 ? "" : ", ",
+                    (unsigned long long)stats->histogram[type][bucket]);
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "}}\n");
+
+    return ferror(out) ? -1 : 0;
+}
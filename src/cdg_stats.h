@@ -0,0 +1,98 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Profiling counters for the decoder: how many packets of each kind were
+ * processed and how long that took, and how many were empty, repeats or
+ * invalid. Nothing is counted unless a CDG_Stats is attached to the state,
+ * and the counting is compiled out entirely unless CDG_STATS is set to 1.
+ *
+ * A CDG_Stats is not safe to share between states decoded on different
+ * threads. Give each thread its own and add them up afterwards.
+ */
+
+#ifndef CDG_STATS_H
+#define CDG_STATS_H
+
+#include <stdio.h> // FILE
+#include <stdint.h> // uint64_t
+
+#include "cdg.h"
+
+/*
+ * Whether counting is compiled in. Build with -DCDG_STATS=1 to profile.
+ */
+#ifndef CDG_STATS
+#define CDG_STATS 0
+#endif
+
+// Bucket n of a histogram counts packets taking at least 2^n and less than
+// 2^(n+1) nanoseconds. Bucket 0 also counts anything faster.
+#define CDG_STATS_BUCKETS 32
+
+struct CDG_Stats {
+    // Packets seen by cdg_decode_range and cdg_fast_forward, and the ones
+    // among them that were skipped: packets without CD+G data, repeated
+    // memory presets, packets with an unknown instruction, and packets
+    // overwritten later when fast-forwarding
+    uint64_t packets;
+    uint64_t empty;
+    uint64_t repeats;
+    uint64_t invalid;
+    uint64_t dead;
+
+    // Calls to cdg_process_packet per packet type, the time spent in them,
+    // and how that time was distributed
+    uint64_t processed[CDG_PACKET_TYPES];
+    uint64_t nanoseconds[CDG_PACKET_TYPES];
+    uint64_t histogram[CDG_PACKET_TYPES][CDG_STATS_BUCKETS];
+};
+
+// Zeroes all counters
+void cdg_stats_init(CDG_Stats *stats);
+
+// Adds the counters of other to stats
+void cdg_stats_add(CDG_Stats *stats, const CDG_Stats *other);
+
+// Counts one processed packet of the given type that took nanoseconds
+void cdg_stats_record(CDG_Stats *stats, packet_t type, uint64_t nanoseconds);
+
+// A monotonic clock in nanoseconds, for timing with cdg_stats_record
+uint64_t cdg_stats_now(void);
+
+// Writes the counters as one JSON object, followed by a newline. Returns 0 on
+// success and -1 if writing failed.
+int cdg_stats_write_json(const CDG_Stats *stats, FILE *out);
+
+/*
+ * Counting macros. stats may be NULL, in which case nothing happens.
+ */
+#if CDG_STATS
+#define CDG_STATS_ADD(stats, counter, n) \
+    do { \
+        if ((stats) != NULL) { \
+            (stats)->counter += (n); \
+        } \
+    } while (0)
+#else
+#define CDG_STATS_ADD(stats, counter, n) ((void)0)
+#endif
+#define CDG_STATS_COUNT(stats, counter) CDG_STATS_ADD(stats, counter, 1)
+
+#endif // CDG_STATS_H
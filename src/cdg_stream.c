@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_stream.h"
+
+#include <string.h> // memcpy
+
+void cdg_stream_init(CDG_Stream *stream, cdg *cdg_state)
+{
+    stream->cdg_state = cdg_state;
+    stream->packets = 0;
+    stream->partial_length = 0;
+}
+
+int cdg_stream_feed(CDG_Stream *stream, const void *buf, size_t len, size_t *packets)
+{
+    const unsigned char *data = buf;
+    size_t consumed = 0;
+    int result = 0;
+
+    // Complete the packet left over from the previous chunk first
+    if (stream->partial_length > 0) {
+        size_t missing = sizeof(SubCode) - stream->partial_length;
+        size_t n = len < missing ? len : missing;
+        memcpy(stream->partial + stream->partial_length, data, n);
+        stream->partial_length += n;
+        data += n;
+        len -= n;
+
+        if (stream->partial_length < sizeof(SubCode)) {
+            if (packets != NULL) {
+                *packets = 0;
+            }
+            return 0;
+        }
+
+        stream->partial_length = 0;
+        if (cdg_decode_range((const SubCode *)stream->partial, 1, stream->cdg_state) != 1) {
+            result = 1;
+        } else {
+            consumed++;
+        }
+    }
+
+    // SubCode is made up of chars only, so the chunk needs no alignment
+    size_t whole = len / sizeof(SubCode);
+    if (result == 0) {
+        size_t done = cdg_decode_range((const SubCode *)data, whole, stream->cdg_state);
+        consumed += done;
+        if (done != whole) {
+            result = 1;
+        }
+    }
+
+    // Keep the start of a packet that continues in the next chunk. After a
+    // failure the rest of the chunk is dropped, as the state it would apply
+    // to is already wrong
+    if (result == 0) {
+        stream->partial_length = len - whole * sizeof(SubCode);
+        memcpy(stream->partial, data + whole * sizeof(SubCode), stream->partial_length);
+    }
+
+    stream->packets += consumed;
+    if (packets != NULL) {
+        *packets = consumed;
+    }
+    return result;
+}
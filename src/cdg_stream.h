@@ -0,0 +1,55 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Streaming decoder for data arriving in chunks of any size, such as from a
+ * pipe, a socket or subchannel reads from an audio CD.
+ */
+
+#ifndef CDG_STREAM_H
+#define CDG_STREAM_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+typedef struct {
+    cdg *cdg_state;
+    size_t packets; // Packets consumed since the stream was set up
+
+    // Bytes of a packet split across chunks
+    unsigned char partial[sizeof(SubCode)];
+    size_t partial_length;
+} CDG_Stream;
+
+// Sets up a stream feeding the given state
+void cdg_stream_init(CDG_Stream *stream, cdg *cdg_state);
+
+/*
+ * Feeds len bytes to the stream. Complete packets are processed straight from
+ * buf, and only a packet split across chunks is copied, so memory use does
+ * not depend on the chunk size. The number of packets decoded from this
+ * chunk is stored in packets if it is not NULL; each packet is 1/300th of a
+ * second. Returns 0 on success and 1 if processing a packet failed. On
+ * failure, packets holds the number of packets decoded before the one that
+ * failed, and the rest of the chunk is dropped.
+ */
+int cdg_stream_feed(CDG_Stream *stream, const void *buf, size_t len, size_t *packets);
+
+#endif // CDG_STREAM_H
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cdg_timeline.h"
+#include "cdg_player.h" // cdg_packet_usecs
+
+#include <stdlib.h> // realloc, free
+#include <string.h> // memset
+#include <errno.h> // errno
+
+// Packets looked at together when searching for CD+G data
+#define GROUP 8
+
+#define BYTES(b) (UINT64_C(0x0101010101010101) * (b))
+
+/*
+ * Whether any of the next 8 packets holds CD+G data. The command bytes are
+ * gathered into one word and compared all at once: a byte of diff is zero
+ * where the command matches, and the usual test for a zero byte in a word
+ * finds whether there is one.
+ */
+static int group_has_data(const SubCode *subs)
+{
+    uint64_t commands = 0;
+    for (int i = 0; i < GROUP; i++) {
+        // The command is a plain char, which must not be sign extended
+        commands |= (uint64_t)(unsigned char)subs[i].command << (8 * i);
+    }
+
+    uint64_t diff = (commands & BYTES(CDG_MASK)) ^ BYTES(CDG_COMMAND);
+    return ((diff - BYTES(0x01)) & ~diff & BYTES(0x80)) != 0;
+}
+
+static int add_event(CDG_Timeline *timeline, size_t packet, packet_t type, unsigned char color)
+{
+    if (timeline->count == timeline->capacity) {
+        size_t capacity = timeline->capacity == 0 ? 64 : timeline->capacity * 2;
+        CDG_Event *events = realloc(timeline->events, capacity * sizeof(CDG_Event));
+        if (events == NULL) {
+            return -1;
+        }
+        timeline->events = events;
+        timeline->capacity = capacity;
+    }
+
+    CDG_Event *event = &timeline->events[timeline->count++];
+    event->packet = packet;
+    event->usecs = cdg_packet_usecs(packet);
+    event->type = type;
+    event->color = color;
+    return 0;
+}
+
+// Adds the event of a packet with CD+G data, if it is one
+static int scan_packet(CDG_Timeline *timeline, const SubCode *sub, size_t packet)
+{
+    if (timeline->end_active == 0) {
+        timeline->first_active = packet;
+    }
+    timeline->end_active = packet + 1;
+
+    unsigned char color = sub->data[0] & 0x0F;
+    switch (cdg_get_instruction(sub)) {
+        case CDG_MEMORY_PRESET:
+            if ((sub->data[1] & 0x0F) != 0) {
+                return 0; // Repeat packet
+            }
+            return add_event(timeline, packet, MEMORY_PRESET, color);
+        case CDG_BORDER_PRESET:
+            return add_event(timeline, packet, BORDER_PRESET, color);
+        case CDG_LOAD_COLORS_LOW:
+            return add_event(timeline, packet, LOAD_COLORS_LOW, 0);
+        case CDG_LOAD_COLORS_HIGH:
+            return add_event(timeline, packet, LOAD_COLORS_HIGH, 0);
+        case CDG_SCROLL_PRESET:
+            return add_event(timeline, packet, SCROLL_PRESET, color);
+        case CDG_SCROLL_COPY:
+            return add_event(timeline, packet, SCROLL_COPY, color);
+        case CDG_DEFINE_TRANSPARENT:
+            return add_event(timeline, packet, DEFINE_TRANSPARENT, color);
+        default:
+            return 0;
+    }
+}
+
+static int scan(CDG_Timeline *timeline, const SubCode *subs, size_t n)
+{
+    // Most packets are empty, so skip them a group at a time
+    size_t i = 0;
+    for (; i + GROUP <= n; i += GROUP) {
+        if (!group_has_data(&subs[i])) {
+            continue;
+        }
+        for (size_t j = i; j < i + GROUP; j++) {
+            if (cdg_contains_data(&subs[j]) && scan_packet(timeline, &subs[j], j) != 0) {
+                return -1;
+            }
+        }
+    }
+    for (; i < n; i++) {
+        if (cdg_contains_data(&subs[i]) && scan_packet(timeline, &subs[i], i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cdg_timeline_build(CDG_Timeline *timeline, const SubCode *subs, size_t n)
+{
+    memset(timeline, 0, sizeof(*timeline));
+
+    if (scan(timeline, subs, n) != 0) {
+        cdg_timeline_free(timeline);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void cdg_timeline_free(CDG_Timeline *timeline)
+{
+    free(timeline->events);
+    memset(timeline, 0, sizeof(*timeline));
+}
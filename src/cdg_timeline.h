@@ -0,0 +1,65 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Timeline of a song: when the screen is cleared, the palette changes and the
+ * screen scrolls, found without decoding any pixels. Meant for listing songs
+ * page by page, and for jumping to a page, where decoding whole songs would
+ * be too slow.
+ */
+
+#ifndef CDG_TIMELINE_H
+#define CDG_TIMELINE_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#include "cdg.h"
+
+typedef struct {
+    size_t packet;       // Where in the stream
+    uint64_t usecs;      // When the packet starts
+    packet_t type;       // One of the types listed below
+    unsigned char color; // The preset color of presets and scrolls
+} CDG_Event;
+
+typedef struct {
+    CDG_Event *events; // Ordered by packet
+    size_t count;
+    size_t capacity;
+
+    // The first packet with CD+G data, and the packet after the last one.
+    // Both are 0 if there are none.
+    size_t first_active;
+    size_t end_active;
+} CDG_Timeline;
+
+/*
+ * Finds the events of a stream: memory presets (but not their repeats),
+ * border presets, palette loads, scrolls and transparency changes. Tile
+ * blocks are not looked at beyond their instruction. Returns 0 on success
+ * and -1 with errno set if memory ran out, in which case the timeline is
+ * empty.
+ */
+int cdg_timeline_build(CDG_Timeline *timeline, const SubCode *subs, size_t n);
+
+// Frees the events of a timeline
+void cdg_timeline_free(CDG_Timeline *timeline);
+
+#endif // CDG_TIMELINE_H
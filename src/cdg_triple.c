@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "cdg_triple.h"
+
+void cdg_triple_init(CDG_Triple *triple)
+{
+    memset(triple->frames, 0, sizeof(triple->frames));
+    // Buffer 0 is written, 1 sits in the middle and 2 is read
+    triple->write = 0;
+    atomic_init(&triple->middle, 1);
+    triple->read = 2;
+    triple->published = 0;
+}
+
+CDG_TripleFrame *cdg_triple_back(CDG_Triple *triple)
+{
+    return &triple->frames[triple->write];
+}
+
+void cdg_triple_swap(CDG_Triple *triple)
+{
+    triple->frames[triple->write].sequence = ++triple->published;
+
+    // Releases the frame to the reader, and acquires the one the reader let
+    // go of, if it has taken the middle buffer since
+    unsigned int old = atomic_exchange_explicit(&triple->middle,
+                                                triple->write | CDG_TRIPLE_FRESH,
+                                                memory_order_acq_rel);
+    triple->write = old & ~CDG_TRIPLE_FRESH;
+}
+
+void cdg_triple_publish(CDG_Triple *triple, const cdg *cdg_state, uint64_t usecs)
+{
+    CDG_TripleFrame *frame = cdg_triple_back(triple);
+    frame->cdg_state = *cdg_state;
+    frame->cdg_state.log = NULL;
+    frame->cdg_state.stats = NULL;
+    frame->usecs = usecs;
+    cdg_triple_swap(triple);
+}
+
+int cdg_triple_acquire(CDG_Triple *triple, CDG_TripleFrame **frame)
+{
+    int fresh = (atomic_load_explicit(&triple->middle, memory_order_relaxed) & CDG_TRIPLE_FRESH) != 0;
+    if (fresh) {
+        unsigned int old = atomic_exchange_explicit(&triple->middle, triple->read,
+                                                    memory_order_acq_rel);
+        triple->read = old & ~CDG_TRIPLE_FRESH;
+    }
+
+    CDG_TripleFrame *current = &triple->frames[triple->read];
+    // Until the first publish, the read buffer was never written
+    *frame = current->sequence != 0 ? current : NULL;
+    return fresh;
+}
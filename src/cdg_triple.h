@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Handing frames from a decoder thread to a render thread. The decoder
+ * publishes snapshots of its state into a triple buffer, and the renderer
+ * picks up the latest one. Neither side ever waits for the other: the
+ * decoder always has a buffer of its own to write to, and a renderer that
+ * falls behind simply misses frames.
+ *
+ * There must be exactly one thread writing and one thread reading.
+ */
+
+#ifndef CDG_TRIPLE_H
+#define CDG_TRIPLE_H
+
+#include <stdint.h> // uint64_t
+#include <stdatomic.h>
+
+#include "cdg.h"
+
+/*
+ * A published frame. The state is a full copy, so it can be converted with
+ * the functions in cdg_convert.h. Its dirty rectangles and palette change are
+ * whatever the writer left in its state, usually the changes since the
+ * previous published frame. The renderer may have missed that one, which it
+ * can tell from the sequence numbers.
+ */
+typedef struct {
+    cdg cdg_state;     // Logging and counting are turned off in the copy
+    uint64_t usecs;    // The playback time the state was brought up to
+    uint64_t sequence; // Counts the frames published, starting at 1
+} CDG_TripleFrame;
+
+typedef struct {
+    CDG_TripleFrame frames[3];
+    // The buffer between the two threads, with CDG_TRIPLE_FRESH set if it
+    // was published after the reader last took one
+    _Alignas(64) atomic_uint middle;
+    // Owned by the writer
+    _Alignas(64) unsigned int write;
+    uint64_t published;
+    // Owned by the reader
+    _Alignas(64) unsigned int read;
+} CDG_Triple;
+
+#define CDG_TRIPLE_FRESH 4u
+
+// Sets up the buffers with nothing published. Must be done before either
+// thread starts using them.
+void cdg_triple_init(CDG_Triple *triple);
+
+// Writer side. Returns the buffer to fill in, which belongs to the writer
+// until the next call to cdg_triple_publish.
+CDG_TripleFrame *cdg_triple_back(CDG_Triple *triple);
+
+// Writer side. Copies the state into the back buffer and publishes it
+void cdg_triple_publish(CDG_Triple *triple, const cdg *cdg_state, uint64_t usecs);
+
+// Writer side. Publishes the back buffer as it was filled in, and hands out a
+// new one
+void cdg_triple_swap(CDG_Triple *triple);
+
+// Reader side. Takes the latest published frame if there is one the reader
+// has not seen yet, and sets *frame to it. Returns 1 if the frame is new and
+// 0 otherwise, in which case *frame is the last frame taken, or NULL if
+// nothing has been published yet. The frame belongs to the reader until the
+// next call, so it may take the dirty rectangles out of it.
+int cdg_triple_acquire(CDG_Triple *triple, CDG_TripleFrame **frame);
+
+#endif // CDG_TRIPLE_H
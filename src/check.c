@@ -0,0 +1,1187 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Consistency checks for the library: the optimized paths are compared with
+ * plain ones, on synthetic songs and on hand-made corner cases. Prints one
+ * line per check, and exits with 1 if any of them failed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h> // mkstemp, close, unlink
+
+#include "cdg.h"
+#include "cdg_compact.h"
+#include "cdg_composite.h"
+#include "cdg_convert.h"
+#include "cdg_encode.h"
+#include "cdg_forward.h"
+#include "cdg_index.h"
+#include "cdg_pack.h"
+#include "cdg_segment.h"
+#include "cdg_stream.h"
+#include "cdg_timeline.h"
+#include "synth.h"
+
+// Length of the synthetic songs checked
+#define SONG_SECONDS 120
+
+static int failures;
+
+// Reports the outcome of one check
+static void report(const char *name, int ok, const char *detail)
+{
+    if (ok) {
+        printf("ok      %s\n", name);
+    } else {
+        printf("FAILED  %s: %s\n", name, detail);
+        failures++;
+    }
+}
+
+// Steps a small linear congruential generator and returns 15 bits of it
+static unsigned int random_next(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+/*
+ * Fills n packets with random ones of every kind, weighted so that screens
+ * get built up between the presets: mostly tiles, some palette loads and
+ * scrolls, stray high bits, repeats, garbage instructions and empty packets
+ */
+static void random_stream(SubCode *subs, size_t n, unsigned int seed)
+{
+    static const unsigned char instructions[] = {
+        CDG_TILE_BLOCK, CDG_TILE_BLOCK, CDG_TILE_BLOCK, CDG_TILE_BLOCK,
+        CDG_TILE_BLOCK_XOR, CDG_TILE_BLOCK_XOR, CDG_TILE_BLOCK_XOR,
+        CDG_LOAD_COLORS_LOW, CDG_LOAD_COLORS_HIGH,
+        CDG_SCROLL_PRESET, CDG_SCROLL_COPY, CDG_DEFINE_TRANSPARENT,
+    };
+    for (size_t i = 0; i < n; i++) {
+        memset(&subs[i], 0, sizeof(subs[i]));
+        for (int k = 0; k < 16; k++) {
+            subs[i].data[k] = (char)random_next(&seed);
+        }
+        unsigned int pick = random_next(&seed) % 256;
+        if (pick < 96) {
+            continue; // Empty
+        }
+        subs[i].command = (char)(CDG_COMMAND | (pick % 4 == 0 ? 0xC0 : 0));
+        if (pick < 98) {
+            subs[i].instruction = CDG_MEMORY_PRESET;
+            // Mostly real presets, but some repeats
+            subs[i].data[1] = (char)(pick % 2 ? subs[i].data[1] & 0x30 : subs[i].data[1]);
+        } else if (pick < 100) {
+            subs[i].instruction = CDG_BORDER_PRESET;
+        } else if (pick < 102) {
+            subs[i].instruction = (char)random_next(&seed); // Mostly garbage
+        } else {
+            unsigned int which = random_next(&seed) % (sizeof(instructions) + 24);
+            subs[i].instruction = (char)(which < sizeof(instructions)
+                                         ? instructions[which]
+                                         : instructions[which % 4]);
+            subs[i].data[2] = (char)(subs[i].data[2] % 32);
+            subs[i].data[3] = (char)(subs[i].data[3] % 64);
+        }
+    }
+}
+
+/*
+ * Fills n packets with pages drawn tile by tile over the whole screen, with
+ * presets, palette loads and fine scrolls mixed in, so that presets and
+ * tiles end up fully covered by later tiles. Nothing moves the screen, as
+ * that would split the range being fast-forwarded.
+ */
+static void cover_stream(SubCode *subs, size_t n, unsigned int seed)
+{
+    const unsigned int tiles = CDG_TILES_X * CDG_TILES_Y;
+    unsigned int next = 0;
+    int edges_only = 0;
+    for (size_t i = 0; i < n; i++) {
+        memset(&subs[i], 0, sizeof(subs[i]));
+        for (int k = 0; k < 16; k++) {
+            subs[i].data[k] = (char)random_next(&seed);
+        }
+        subs[i].command = CDG_COMMAND;
+        unsigned int pick = random_next(&seed) % 1000;
+        if (pick < 700) {
+            // Visits every tile once per pass, in a scattered order, or only
+            // the ones along the edges of the screen on some passes
+            unsigned int tile;
+            do {
+                if (next % tiles == 0) {
+                    edges_only = random_next(&seed) % 2;
+                }
+                tile = next++ * 7919 % tiles;
+            } while (edges_only && tile / CDG_TILES_X != 0 && tile / CDG_TILES_X != CDG_TILES_Y - 1
+                     && tile % CDG_TILES_X != 0 && tile % CDG_TILES_X != CDG_TILES_X - 1);
+            subs[i].instruction = pick < 640 ? CDG_TILE_BLOCK : CDG_TILE_BLOCK_XOR;
+            subs[i].data[2] = (char)(tile / CDG_TILES_X);
+            subs[i].data[3] = (char)(tile % CDG_TILES_X);
+        } else if (pick < 702) {
+            subs[i].instruction = CDG_MEMORY_PRESET;
+            subs[i].data[1] = 0;
+        } else if (pick < 704) {
+            subs[i].instruction = CDG_BORDER_PRESET;
+        } else if (pick < 734) {
+            subs[i].instruction = pick % 2 ? CDG_LOAD_COLORS_LOW : CDG_LOAD_COLORS_HIGH;
+        } else if (pick < 739) {
+            subs[i].instruction = CDG_DEFINE_TRANSPARENT;
+        } else if (pick < 744) {
+            // Fine offsets only, which keeps the screen where it is
+            subs[i].instruction = pick % 2 ? CDG_SCROLL_PRESET : CDG_SCROLL_COPY;
+            subs[i].data[1] &= 0x0F;
+            subs[i].data[2] &= 0x0F;
+        } else {
+            memset(&subs[i], 0, sizeof(subs[i]));
+        }
+    }
+}
+
+/*
+ * Fills n packets with frequent memory and border presets, and scrolls,
+ * palette loads and transparent colors often falling between the two
+ */
+static void preset_stream(SubCode *subs, size_t n, unsigned int seed)
+{
+    static const unsigned char instructions[] = {
+        CDG_TILE_BLOCK, CDG_TILE_BLOCK, CDG_TILE_BLOCK_XOR,
+        CDG_MEMORY_PRESET, CDG_BORDER_PRESET,
+        CDG_SCROLL_PRESET, CDG_SCROLL_COPY,
+        CDG_LOAD_COLORS_LOW, CDG_LOAD_COLORS_HIGH, CDG_DEFINE_TRANSPARENT,
+    };
+    for (size_t i = 0; i < n; i++) {
+        memset(&subs[i], 0, sizeof(subs[i]));
+        for (int k = 0; k < 16; k++) {
+            subs[i].data[k] = (char)random_next(&seed);
+        }
+        subs[i].command = CDG_COMMAND;
+        subs[i].instruction = instructions[random_next(&seed) % sizeof(instructions)];
+        subs[i].data[1] &= subs[i].instruction == CDG_MEMORY_PRESET ? 0x30 : 0x3F;
+        subs[i].data[2] = (char)(subs[i].data[2] % 32);
+        subs[i].data[3] = (char)(subs[i].data[3] % 64);
+    }
+}
+
+static void make_packet(SubCode *sub, char command, unsigned char instruction, unsigned char color)
+{
+    memset(sub, 0, sizeof(*sub));
+    sub->command = command;
+    sub->instruction = instruction;
+    sub->data[0] = color;
+}
+
+/*
+ * A command byte with the high bit set, in the same group of eight packets
+ * as a real one. The high bit is not part of the command, so the first
+ * packet holds no CD+G data, but it must not hide the packets after it.
+ */
+static void check_timeline_high_bit(void)
+{
+    SubCode subs[16];
+    for (int i = 0; i < 16; i++) {
+        make_packet(&subs[i], 0, 0, 0);
+    }
+    make_packet(&subs[0], (char)0x80, CDG_MEMORY_PRESET, 1);
+    make_packet(&subs[3], CDG_COMMAND, CDG_MEMORY_PRESET, 2);
+    make_packet(&subs[9], (char)(0xC0 | CDG_COMMAND), CDG_BORDER_PRESET, 3);
+
+    CDG_Timeline timeline;
+    if (cdg_timeline_build(&timeline, subs, 16) != 0) {
+        report("timeline/high-bit", 0, "out of memory");
+        return;
+    }
+    int ok = timeline.count == 2
+          && timeline.events[0].packet == 3 && timeline.events[0].type == MEMORY_PRESET
+          && timeline.events[1].packet == 9 && timeline.events[1].type == BORDER_PRESET;
+    report("timeline/high-bit", ok, "expected events at packets 3 and 9");
+    cdg_timeline_free(&timeline);
+}
+
+// The timeline has an event for every packet that the decoder would treat as
+// one, and for no others
+static void check_timeline(const SubCode *song, size_t count)
+{
+    CDG_Timeline timeline;
+    if (cdg_timeline_build(&timeline, song, count) != 0) {
+        report("timeline/song", 0, "out of memory");
+        return;
+    }
+
+    size_t next = 0;
+    int ok = 1;
+    for (size_t i = 0; i < count && ok; i++) {
+        CDG_Packet packet = cdg_parse_packet(&song[i]);
+        int event = packet.type != EMPTY && packet.type != TILE_BLOCK
+                 && packet.type != TILE_BLOCK_XOR;
+        if (event) {
+            ok = next < timeline.count && timeline.events[next].packet == i
+              && timeline.events[next].type == packet.type;
+            next++;
+        }
+    }
+    report("timeline/song", ok && next == timeline.count, "events differ from parsing every packet");
+    cdg_timeline_free(&timeline);
+}
+
+// Creates an empty temporary file and writes its name to name
+static int temp_file(char name[32])
+{
+    strcpy(name, "/tmp/cdg_check_XXXXXX");
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// An index saved and loaded again seeks to the same states as a full decode,
+// with and without periodic snapshots
+static void check_index(const SubCode *song, size_t count)
+{
+    char name[32];
+    if (temp_file(name) != 0) {
+        report("index/save-load", 0, strerror(errno));
+        return;
+    }
+
+    static const size_t intervals[] = { 0, CDG_PACKETS_PER_SECOND * 10 };
+    for (size_t k = 0; k < sizeof(intervals) / sizeof(intervals[0]); k++) {
+        const char *name_k = intervals[k] == 0 ? "index/presets-only" : "index/interval";
+        CDG_Index built;
+        CDG_Index loaded;
+        if (cdg_index_build(&built, song, count, intervals[k]) != 0) {
+            report(name_k, 0, "out of memory");
+            continue;
+        }
+        if (cdg_index_save(&built, name) != 0 || cdg_index_load(&loaded, name) != 0) {
+            report(name_k, 0, "saved index does not load");
+            cdg_index_free(&built);
+            continue;
+        }
+
+        static cdg expected;
+        static cdg sought;
+        int ok = loaded.count == built.count;
+        for (size_t target = 0; target <= count && ok; target += count / 7) {
+            cdg_init(&expected);
+            cdg_decode_range(song, target, &expected);
+            ok = cdg_seek(&sought, &loaded, song, target) == 0
+              && memcmp(expected.pixels, sought.pixels, sizeof(expected.pixels)) == 0;
+        }
+        report(name_k, ok, "seeking differs from decoding");
+        cdg_index_free(&loaded);
+        cdg_index_free(&built);
+    }
+
+    // A header promising more snapshots than the file holds, large enough to
+    // overflow the size of the allocation
+    FILE *file = fopen(name, "r+b");
+    unsigned char huge[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F };
+    int written = file != NULL && fseek(file, 8, SEEK_SET) == 0
+               && fwrite(huge, sizeof(huge), 1, file) == 1
+               && fwrite(huge, sizeof(huge), 1, file) == 1;
+    if (file != NULL) {
+        fclose(file);
+    }
+    CDG_Index index;
+    report("index/bad-count", written && cdg_index_load(&index, name) != 0 && errno == EINVAL,
+           "an index with an impossible count was loaded");
+
+    unlink(name);
+}
+
+// Screen used by the reference decoder below, in displayed coordinates
+typedef unsigned char reference_screen[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+
+/*
+ * Applies a tile block or a scroll copy the plain way, one pixel at a time
+ * and straight from the raw packet, without a moving origin
+ */
+static void reference_apply(reference_screen screen, const SubCode *sub)
+{
+    static reference_screen old;
+    unsigned char instruction = sub->instruction & CDG_MASK;
+    const unsigned char *data = (const unsigned char *)sub->data;
+
+    if (instruction == CDG_TILE_BLOCK || instruction == CDG_TILE_BLOCK_XOR) {
+        int row = data[2] & 0x1F;
+        int column = data[3] & 0x3F;
+        if (row >= CDG_TILES_Y || column >= CDG_TILES_X) {
+            return;
+        }
+        for (int y = 0; y < CDG_TILE_HEIGHT; y++) {
+            for (int x = 0; x < CDG_TILE_WIDTH; x++) {
+                int bit = (data[4 + y] >> (CDG_TILE_WIDTH - 1 - x)) & 1;
+                unsigned char color = data[bit] & 0x0F;
+                unsigned char *pixel = &screen[row * CDG_TILE_HEIGHT + y][column * CDG_TILE_WIDTH + x];
+                *pixel = instruction == CDG_TILE_BLOCK_XOR ? *pixel ^ color : color;
+            }
+        }
+    } else if (instruction == CDG_SCROLL_COPY) {
+        int h = (data[1] >> 4) & 0x03;
+        int v = (data[2] >> 4) & 0x03;
+        int dx = h == SCROLL_LEFT ? CDG_TILE_WIDTH : h == SCROLL_RIGHT ? -CDG_TILE_WIDTH : 0;
+        int dy = v == SCROLL_UP ? CDG_TILE_HEIGHT : v == SCROLL_DOWN ? -CDG_TILE_HEIGHT : 0;
+        memcpy(old, screen, sizeof(old));
+        for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < CDG_SCREEN_WIDTH; x++) {
+                screen[y][x] = old[(y + dy + CDG_SCREEN_HEIGHT) % CDG_SCREEN_HEIGHT]
+                                  [(x + dx + CDG_SCREEN_WIDTH) % CDG_SCREEN_WIDTH];
+            }
+        }
+    }
+}
+
+/*
+ * Tile blocks written a word at a time match the reference, for random
+ * tiles in both modes with stray high bits, addresses off the screen and
+ * scrolls that move the origin in between. The whole matrix is compared, so
+ * a row store that spills into the next tile is caught too.
+ */
+static void check_tiles(void)
+{
+    enum { PACKETS = 16000 };
+    static cdg decoded;
+    static reference_screen expected;
+    static SubCode subs[PACKETS];
+
+    unsigned int seed = 7;
+    for (int i = 0; i < PACKETS; i++) {
+        memset(&subs[i], 0, sizeof(subs[i]));
+        subs[i].command = CDG_COMMAND;
+        for (int k = 0; k < 16; k++) {
+            subs[i].data[k] = (char)random_next(&seed);
+        }
+        unsigned int pick = random_next(&seed) % 64;
+        if (pick == 0) {
+            subs[i].instruction = CDG_SCROLL_COPY;
+            subs[i].data[1] &= 0x30; // Whole tiles only, no fine offset
+            subs[i].data[2] &= 0x30;
+        } else {
+            subs[i].instruction = pick % 2 ? CDG_TILE_BLOCK : CDG_TILE_BLOCK_XOR;
+            subs[i].data[2] %= CDG_TILES_Y + 1;
+            subs[i].data[3] %= CDG_TILES_X + 1;
+        }
+    }
+
+    cdg_init(&decoded);
+    memset(expected, 0, sizeof(expected));
+    int ok = 1;
+    for (int i = 0; i < PACKETS && ok; i++) {
+        ok = cdg_decode_range(&subs[i], 1, &decoded) == 1;
+        reference_apply(expected, &subs[i]);
+        if (i % 16 != 15) {
+            continue;
+        }
+
+        for (int y = 0; y < CDG_SCREEN_HEIGHT && ok; y++) {
+            const unsigned char *row = decoded.pixels[(y + decoded.origin_y) % CDG_SCREEN_HEIGHT];
+            for (int x = 0; x < CDG_SCREEN_WIDTH && ok; x++) {
+                ok = row[(x + decoded.origin_x) % CDG_SCREEN_WIDTH] == expected[y][x];
+            }
+        }
+    }
+    report("decode/tiles", ok, "a tile block differs from the reference");
+}
+
+// Whether two states show the same screen in the same colors
+static int same_screen(const cdg *a, const cdg *b)
+{
+    unsigned char row_a[CDG_SCREEN_WIDTH];
+    unsigned char row_b[CDG_SCREEN_WIDTH];
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        cdg_get_row(a, 0, y, CDG_SCREEN_WIDTH, row_a);
+        cdg_get_row(b, 0, y, CDG_SCREEN_WIDTH, row_b);
+        if (memcmp(row_a, row_b, sizeof(row_a)) != 0) {
+            return 0;
+        }
+    }
+    return memcmp(a->color_table, b->color_table, sizeof(a->color_table)) == 0
+        && a->transparent_color == b->transparent_color;
+}
+
+/*
+ * Frames taken from the synthetic song, and one of noise that needs many
+ * colors in every tile, are encoded and decoded again. Once the packets of a
+ * frame are in, the decoder must show exactly that frame in its colors.
+ */
+static void check_encoder(const SubCode *song, size_t count)
+{
+    enum { FRAMES = 16 };
+    static unsigned char pixels[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+    static cdg source;
+    static cdg decoded;
+    static CDG_Encoder encoder;
+    size_t ends[FRAMES];
+    CDG_RGB tables[FRAMES][16];
+    unsigned char screens[FRAMES][CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+
+    cdg_encoder_init(&encoder);
+    cdg_init(&source);
+    size_t done = 0;
+    unsigned int noise = 1;
+    int ok = 1;
+    for (int f = 0; f < FRAMES && ok; f++) {
+        CDG_Frame frame;
+        if (f == FRAMES / 2) {
+            for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+                for (int x = 0; x < CDG_SCREEN_WIDTH; x++) {
+                    pixels[y][x] = random_next(&noise) & 0x0F;
+                }
+            }
+            for (int i = 0; i < 16; i++) {
+                frame.color_table[i] = (CDG_RGB){ (unsigned char)i, (unsigned char)(15 - i), 7 };
+            }
+        } else {
+            size_t target = count / FRAMES * (f + 1);
+            cdg_decode_range(song + done, target - done, &source);
+            done = target;
+            for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+                cdg_get_row(&source, 0, y, CDG_SCREEN_WIDTH, pixels[y]);
+            }
+            memcpy(frame.color_table, source.color_table, sizeof(frame.color_table));
+        }
+        frame.packet = (size_t)(f + 1) * CDG_PACKETS_PER_SECOND * 4;
+        frame.pixels = &pixels[0][0];
+        frame.stride = CDG_SCREEN_WIDTH;
+
+        // A late frame is still encoded, so only running out of memory or
+        // a mismatch the encoder noticed itself stops the check
+        ok = cdg_encoder_add_frame(&encoder, &frame) >= 0;
+        ends[f] = encoder.count;
+        memcpy(tables[f], frame.color_table, sizeof(tables[f]));
+        memcpy(screens[f], pixels, sizeof(pixels));
+    }
+
+    cdg_init(&decoded);
+    done = 0;
+    for (int f = 0; f < FRAMES && ok; f++) {
+        ok = cdg_decode_range(encoder.packets + done, ends[f] - done, &decoded) == ends[f] - done;
+        done = ends[f];
+        for (int y = 0; y < CDG_SCREEN_HEIGHT && ok; y++) {
+            unsigned char row[CDG_SCREEN_WIDTH];
+            cdg_get_row(&decoded, 0, y, CDG_SCREEN_WIDTH, row);
+            ok = memcmp(row, screens[f][y], sizeof(row)) == 0;
+        }
+        ok = ok && memcmp(decoded.color_table, tables[f], sizeof(tables[f])) == 0;
+    }
+    report("encoder/round-trip", ok, "a decoded frame differs from the one encoded");
+    cdg_encoder_free(&encoder);
+}
+
+// Feeding a stream in chunks of awkward sizes ends in the same state as
+// decoding it in one go
+static void check_stream(const SubCode *song, size_t count)
+{
+    static const size_t chunks[] = { 1, 7, 23, 24, 25, 100, 4099 };
+    static cdg expected;
+    static cdg fed;
+
+    cdg_init(&expected);
+    cdg_decode_range(song, count, &expected);
+
+    cdg_init(&fed);
+    CDG_Stream stream;
+    cdg_stream_init(&stream, &fed);
+    const unsigned char *data = (const unsigned char *)song;
+    size_t length = count * sizeof(SubCode);
+    size_t offset = 0;
+    size_t total = 0;
+    int ok = 1;
+    for (size_t i = 0; offset < length && ok; i++) {
+        size_t n = chunks[i % (sizeof(chunks) / sizeof(chunks[0]))];
+        if (n > length - offset) {
+            n = length - offset;
+        }
+        size_t packets;
+        ok = cdg_stream_feed(&stream, data + offset, n, &packets) == 0;
+        total += packets;
+        offset += n;
+    }
+    ok = ok && total == count && stream.packets == count && same_screen(&expected, &fed);
+    report("stream/chunked", ok, "the fed state differs from the decoded one");
+}
+
+/*
+ * A pack keeps the instruction and data of every packet with CD+G data, and
+ * decoding it from any position, with or without a seek index, gives the
+ * same state as decoding the packets
+ */
+static void check_pack(const SubCode *song, size_t count)
+{
+    static const size_t intervals[] = { 0, 1, CDG_PACKETS_PER_SECOND * 10 };
+    static const char *names[][2] = {
+        { "pack/round-trip", "pack/seek" },
+        { "pack/round-trip-index-1", "pack/seek-index-1" },
+        { "pack/round-trip-index", "pack/seek-index" },
+    };
+    static cdg expected;
+    static cdg decoded;
+    SubCode *unpacked = malloc(count * sizeof(SubCode));
+    if (unpacked == NULL) {
+        report("pack/round-trip", 0, "out of memory");
+        return;
+    }
+
+    for (size_t k = 0; k < sizeof(intervals) / sizeof(intervals[0]); k++) {
+        unsigned char *data;
+        size_t size;
+        CDG_Pack pack;
+        if (cdg_pack_encode(song, count, intervals[k], &data, &size) != 0) {
+            report(names[k][0], 0, "out of memory");
+            break;
+        }
+        int ok = cdg_pack_load(&pack, data, size) == 0 && pack.count == count;
+        if (ok) {
+            cdg_pack_unpack(&pack, unpacked);
+        }
+        for (size_t i = 0; i < count && ok; i++) {
+            int live = cdg_contains_data(&song[i]);
+            ok = cdg_contains_data(&unpacked[i]) == live;
+            if (live && ok) {
+                ok = cdg_get_instruction(&unpacked[i]) == cdg_get_instruction(&song[i]);
+                for (int j = 0; j < 16 && ok; j++) {
+                    ok = (unpacked[i].data[j] & CDG_MASK) == (song[i].data[j] & CDG_MASK);
+                }
+            }
+        }
+        report(names[k][0], ok,
+               "unpacked packets differ from the packed ones");
+
+        // Seek to random positions, backwards as well as forwards, and decode
+        // a random stretch from there
+        CDG_PackCursor cursor;
+        cdg_pack_cursor_init(&cursor, &pack);
+        unsigned int seed = 11;
+        for (int i = 0; i < 24 && ok; i++) {
+            size_t position = ((size_t)random_next(&seed) << 15 | random_next(&seed)) % count;
+            size_t n = random_next(&seed) % (CDG_PACKETS_PER_SECOND * 20);
+            size_t end = position + n < count ? position + n : count;
+            cdg_init(&expected);
+            cdg_decode_range(song, end, &expected);
+            cdg_init(&decoded);
+            cdg_decode_range(song, position, &decoded);
+
+            cdg_pack_seek(&cursor, position);
+            ok = cdg_pack_decode(&cursor, n, &decoded) == end - position
+              && cursor.position == end && same_screen(&expected, &decoded);
+        }
+        report(names[k][1], ok,
+               "decoding after a seek differs from decoding the packets");
+        free(data);
+    }
+    free(unpacked);
+
+    // Every truncation of a pack, and a few corruptions of its header, seek
+    // index and records, must be rejected
+    size_t short_count = count < 3000 ? count : 3000;
+    unsigned char *data;
+    size_t size;
+    if (cdg_pack_encode(song, short_count, 100, &data, &size) != 0) {
+        report("pack/reject", 0, "out of memory");
+        return;
+    }
+    CDG_Pack pack;
+    int ok = 1;
+    for (size_t length = 0; length < size && ok; length++) {
+        ok = cdg_pack_load(&pack, data, length) != 0 && errno == EINVAL;
+    }
+    static const size_t corrupt[] = {
+        0,      // Magic
+        8,      // Packet count, which no longer matches the number of entries
+        32,     // Interval, likewise
+        40,     // Base of the first index entry
+        48 + 8, // Offset of the second index entry
+    };
+    for (size_t i = 0; i < sizeof(corrupt) / sizeof(corrupt[0]) && ok; i++) {
+        data[corrupt[i]] ^= 0x55;
+        ok = cdg_pack_load(&pack, data, size) != 0 && errno == EINVAL;
+        data[corrupt[i]] ^= 0x55;
+    }
+    // A gap that never ends, in place of the last record
+    unsigned char saved = data[size - 18];
+    data[size - 18] = 0xFF;
+    ok = ok && cdg_pack_load(&pack, data, size) != 0 && errno == EINVAL;
+    data[size - 18] = saved;
+    ok = ok && cdg_pack_load(&pack, data, size) == 0;
+    report("pack/reject", ok, "a truncated or corrupt pack was loaded");
+    free(data);
+}
+
+/*
+ * Whether two states have the same pixel matrix, palette, transparent color,
+ * origin and fine offsets
+ */
+static int same_state(const cdg *a, const cdg *b)
+{
+    for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+        if (memcmp(a->pixels[y], b->pixels[y], CDG_SCREEN_WIDTH) != 0) {
+            return 0;
+        }
+    }
+    return memcmp(a->color_table, b->color_table, sizeof(a->color_table)) == 0
+        && a->transparent_color == b->transparent_color
+        && a->origin_x == b->origin_x && a->origin_y == b->origin_y
+        && a->offset_x == b->offset_x && a->offset_y == b->offset_y;
+}
+
+/*
+ * Fast-forwarding in random steps ends each step in the same state as
+ * decoding every packet, and marks as dirty every tile of the displayed
+ * screen that changed during the step, and the palette if it changed
+ */
+static void check_fast_forward_stream(const char *name, const SubCode *subs, size_t count,
+                                      unsigned int seed)
+{
+    static cdg expected;
+    static cdg fast;
+    static cdg before;
+    static unsigned char shown[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+    static unsigned char now[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+
+    cdg_init(&expected);
+    cdg_init(&fast);
+    int ok = 1;
+    const char *detail = "";
+    for (size_t done = 0; done < count && ok; ) {
+        size_t n = 1 + random_next(&seed) % (random_next(&seed) % 8 == 0 ? 8000 : 300);
+        if (n > count - done) {
+            n = count - done;
+        }
+
+        before = fast;
+        for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+            cdg_get_row(&fast, 0, y, CDG_SCREEN_WIDTH, shown[y]);
+        }
+        cdg_dirty_clear(&fast);
+
+        ok = cdg_decode_range(subs + done, n, &expected) == n
+          && cdg_fast_forward(subs + done, n, &fast) == n;
+        done += n;
+        if (!ok || !same_state(&expected, &fast)) {
+            ok = 0;
+            detail = "the state differs from decoding every packet";
+            break;
+        }
+
+        if (memcmp(before.color_table, fast.color_table, sizeof(fast.color_table)) != 0
+                || before.transparent_color != fast.transparent_color) {
+            ok = fast.palette_dirty;
+        }
+        for (int y = 0; y < CDG_SCREEN_HEIGHT; y++) {
+            cdg_get_row(&fast, 0, y, CDG_SCREEN_WIDTH, now[y]);
+        }
+        for (int row = 0; row < CDG_TILES_Y && ok; row++) {
+            for (int column = 0; column < CDG_TILES_X && ok; column++) {
+                int changed = 0;
+                for (int y = row * CDG_TILE_HEIGHT; y < (row + 1) * CDG_TILE_HEIGHT; y++) {
+                    changed |= memcmp(&shown[y][column * CDG_TILE_WIDTH],
+                                      &now[y][column * CDG_TILE_WIDTH], CDG_TILE_WIDTH) != 0;
+                }
+                ok = !changed || (fast.dirty[row] >> column & 1);
+            }
+        }
+        if (!ok) {
+            detail = "a change is not marked as dirty";
+        }
+    }
+    report(name, ok, detail);
+}
+
+static void check_fast_forward(const SubCode *song, size_t count)
+{
+    size_t random_count = (size_t)CDG_PACKETS_PER_SECOND * 300;
+    SubCode *subs = malloc(random_count * sizeof(SubCode));
+    if (subs == NULL) {
+        report("forward/random", 0, "out of memory");
+        return;
+    }
+    random_stream(subs, random_count, 3);
+    check_fast_forward_stream("forward/random", subs, random_count, 5);
+    cover_stream(subs, random_count, 4);
+    check_fast_forward_stream("forward/covered", subs, random_count, 6);
+    free(subs);
+
+    check_fast_forward_stream("forward/song", song, count, 9);
+}
+
+/*
+ * The state a segment starts from matches decoding the stream from packet 0
+ * up to where the segment begins, and decoding the segment from there
+ * matches it again at the next boundary
+ */
+static void check_segments_stream(const char *name, const SubCode *subs, size_t count,
+                                  size_t min_length)
+{
+    static cdg expected;
+    static cdg started;
+    CDG_Segments segments;
+    if (cdg_segments_find(&segments, subs, count, min_length) != 0) {
+        report(name, 0, "out of memory");
+        return;
+    }
+
+    int ok = segments.count > 1 && segments.segments[0].begin == 0;
+    const char *detail = "the stream was not split";
+    cdg_init(&expected);
+    for (size_t i = 0; i < segments.count && ok; i++) {
+        size_t begin = segments.segments[i].begin;
+        size_t end = i + 1 < segments.count ? segments.segments[i + 1].begin : count;
+        if (end <= begin || (i + 1 < segments.count && end - begin < min_length)) {
+            ok = 0;
+            detail = "a segment is out of order or too short";
+            break;
+        }
+
+        cdg_init(&started);
+        cdg_segment_start(&segments.segments[i], &started);
+        if (!same_state(&expected, &started)) {
+            ok = 0;
+            detail = "a segment starts from a different state";
+            break;
+        }
+
+        cdg_decode_range(subs + begin, end - begin, &expected);
+        cdg_decode_range(subs + begin, end - begin, &started);
+        if (!same_state(&expected, &started)) {
+            ok = 0;
+            detail = "decoding a segment ends in a different state";
+        }
+    }
+    report(name, ok, detail);
+    cdg_segments_free(&segments);
+}
+
+static void check_segments(const SubCode *song, size_t count)
+{
+    size_t random_count = (size_t)CDG_PACKETS_PER_SECOND * 300;
+    SubCode *subs = malloc(random_count * sizeof(SubCode));
+    if (subs == NULL) {
+        report("segment/random", 0, "out of memory");
+        return;
+    }
+    // Scrolls that move the screen, palette loads and fine offsets between
+    // the presets
+    random_stream(subs, random_count, 13);
+    check_segments_stream("segment/random", subs, random_count, 0);
+    check_segments_stream("segment/random-long", subs, random_count, CDG_PACKETS_PER_SECOND * 10);
+    preset_stream(subs, random_count, 17);
+    check_segments_stream("segment/presets", subs, random_count, 0);
+    free(subs);
+
+    check_segments_stream("segment/song", song, count, 0);
+    check_segments_stream("segment/song-long", song, count, CDG_PACKETS_PER_SECOND * 30);
+}
+
+// A frame for the compositing checks, with all its planes in one block
+typedef struct {
+    CDG_YuvFrame frame;
+    unsigned char *data;
+    size_t size;
+} test_frame;
+
+// Allocates a frame with padded strides, filled with noise
+static int test_frame_alloc(test_frame *t, CDG_YuvLayout layout, int width, int height,
+                            unsigned int seed)
+{
+    t->frame.layout = layout;
+    t->frame.width = width;
+    t->frame.height = height;
+    t->frame.strides[0] = width + 3;
+    t->frame.strides[1] = layout == CDG_YUV_NV12 ? (size_t)width + 5 : (size_t)width / 2 + 5;
+    t->frame.strides[2] = layout == CDG_YUV_NV12 ? 0 : (size_t)width / 2 + 7;
+    size_t sizes[3] = {
+        t->frame.strides[0] * height,
+        t->frame.strides[1] * (height / 2),
+        t->frame.strides[2] * (height / 2),
+    };
+    t->size = sizes[0] + sizes[1] + sizes[2];
+    t->data = malloc(t->size);
+    if (t->data == NULL) {
+        return -1;
+    }
+    t->frame.planes[0] = t->data;
+    t->frame.planes[1] = t->data + sizes[0];
+    t->frame.planes[2] = layout == CDG_YUV_NV12 ? NULL : t->data + sizes[0] + sizes[1];
+    for (size_t i = 0; i < t->size; i++) {
+        t->data[i] = (unsigned char)random_next(&seed);
+    }
+    return 0;
+}
+
+/*
+ * Composites the whole screen the plain way: every frame pixel looks up its
+ * screen pixel, and every chroma sample averages its four pixels, where
+ * transparent pixels and those off the screen count with the video
+ */
+static void reference_composite(const cdg *cdg_state, const CDG_YuvFrame *frame,
+                                int x, int y, int scale)
+{
+    int luma[16];
+    int chroma[2][16];
+    for (int i = 0; i < 16; i++) {
+        int r = cdg_state->color_table[i].red * 0x11;
+        int g = cdg_state->color_table[i].green * 0x11;
+        int b = cdg_state->color_table[i].blue * 0x11;
+        luma[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        chroma[0][i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        chroma[1][i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+
+    // The color index of each frame pixel, or -1 where the video shows
+    static int indices[2][CDG_SCREEN_WIDTH * 4 + 64];
+    for (int fy = 0; fy < frame->height; fy += 2) {
+        for (int i = 0; i < 2; i++) {
+            int sy = fy + i - y;
+            unsigned char row[CDG_SCREEN_WIDTH];
+            if (sy >= 0 && sy < CDG_SCREEN_HEIGHT * scale) {
+                cdg_get_row(cdg_state, 0, sy / scale, CDG_SCREEN_WIDTH, row);
+            }
+            for (int fx = 0; fx < frame->width; fx++) {
+                int sx = fx - x;
+                indices[i][fx] = -1;
+                if (sx >= 0 && sy >= 0 && sx < CDG_SCREEN_WIDTH * scale
+                        && sy < CDG_SCREEN_HEIGHT * scale) {
+                    int index = row[sx / scale];
+                    indices[i][fx] = index == cdg_state->transparent_color ? -1 : index;
+                }
+                if (indices[i][fx] >= 0) {
+                    frame->planes[0][(fy + i) * frame->strides[0] + fx] = luma[indices[i][fx]];
+                }
+            }
+        }
+
+        for (int cx = 0; cx < frame->width / 2; cx++) {
+            for (int k = 0; k < 2; k++) {
+                unsigned char *sample = frame->layout == CDG_YUV_NV12
+                    ? frame->planes[1] + fy / 2 * frame->strides[1] + 2 * cx + k
+                    : frame->planes[1 + k] + fy / 2 * frame->strides[1 + k] + cx;
+                int sum = 0;
+                for (int i = 0; i < 4; i++) {
+                    int index = indices[i / 2][2 * cx + i % 2];
+                    sum += index < 0 ? *sample : chroma[k][index];
+                }
+                *sample = (sum + 2) / 4;
+            }
+        }
+    }
+}
+
+/*
+ * Compositing matches the reference in both layouts, at several scales and
+ * positions that clip the screen, over noise so that any blending is seen.
+ * The dirty variant keeps up with a stream that changes the screen, the
+ * palette and the transparent color, restoring the background under pixels
+ * that turn transparent.
+ */
+static void check_composite(void)
+{
+    enum { PACKETS = 6000 };
+    static SubCode subs[PACKETS];
+    static cdg state;
+    random_stream(subs, PACKETS, 19);
+
+    unsigned int seed = 23;
+    int ok = 1;
+    int dirty_ok = 1;
+    for (int layout = 0; layout < 2; layout++) {
+        for (int scale = 1; scale <= 4 && ok && dirty_ok; scale++) {
+            int width = (CDG_SCREEN_WIDTH * scale + 40) & ~1;
+            int height = (CDG_SCREEN_HEIGHT * scale + 20) & ~1;
+            int x = (random_next(&seed) % (width / 2)) & ~1;
+            int y = (random_next(&seed) % (height / 2)) & ~1;
+            if (scale == 2) {
+                x = 0;
+                y = 0;
+            }
+
+            test_frame background;
+            test_frame frame;
+            test_frame expected;
+            if (test_frame_alloc(&background, layout, width, height, seed) != 0
+                    || test_frame_alloc(&frame, layout, width, height, 0) != 0
+                    || test_frame_alloc(&expected, layout, width, height, 0) != 0) {
+                report("composite/reference", 0, "out of memory");
+                return;
+            }
+
+            // The whole screen, over fresh video after every stretch
+            cdg_init(&state);
+            for (size_t done = 0; done < PACKETS && ok; done += PACKETS / 8) {
+                cdg_decode_range(subs + done, PACKETS / 8, &state);
+                memcpy(frame.data, background.data, background.size);
+                memcpy(expected.data, background.data, background.size);
+                ok = cdg_composite(&state, &frame.frame, x, y, scale) == 0;
+                reference_composite(&state, &expected.frame, x, y, scale);
+                ok = ok && memcmp(frame.data, expected.data, frame.size) == 0;
+            }
+
+            // Only the dirty parts, onto a frame kept from the last call
+            cdg_init(&state);
+            memcpy(frame.data, background.data, background.size);
+            for (size_t done = 0; done < PACKETS && dirty_ok; ) {
+                size_t n = 1 + random_next(&seed) % 1200;
+                n = n < PACKETS - done ? n : PACKETS - done;
+                cdg_decode_range(subs + done, n, &state);
+                done += n;
+                dirty_ok = cdg_composite_dirty(&state, &background.frame, &frame.frame, x, y, scale) >= 0;
+                memcpy(expected.data, background.data, background.size);
+                reference_composite(&state, &expected.frame, x, y, scale);
+                dirty_ok = dirty_ok && memcmp(frame.data, expected.data, frame.size) == 0;
+            }
+
+            free(background.data);
+            free(frame.data);
+            free(expected.data);
+        }
+    }
+    report("composite/reference", ok, "compositing differs from the reference");
+    report("composite/dirty", dirty_ok, "compositing dirty parts differs from the reference");
+}
+
+/*
+ * Decoding into the compact state in random steps shows the same screen as
+ * the full state after every step, and unpacking it, or packing the full
+ * state, gives the same state back
+ */
+static void check_compact_stream(const char *name, const SubCode *subs, size_t count,
+                                 unsigned int seed)
+{
+    static cdg full;
+    static cdg unpacked;
+    static CDG_Compact compact;
+    static CDG_Compact packed;
+
+    cdg_init(&full);
+    cdg_compact_init(&compact);
+    int ok = 1;
+    const char *detail = "";
+    for (size_t done = 0; done < count && ok; ) {
+        size_t n = 1 + random_next(&seed) % 500;
+        n = n < count - done ? n : count - done;
+        ok = cdg_decode_range(subs + done, n, &full) == n
+          && cdg_compact_decode_range(subs + done, n, &compact) == n;
+        done += n;
+
+        unsigned char expected[CDG_SCREEN_WIDTH];
+        unsigned char row[CDG_SCREEN_WIDTH];
+        for (int y = 0; y < CDG_SCREEN_HEIGHT && ok; y++) {
+            cdg_get_row(&full, 0, y, CDG_SCREEN_WIDTH, expected);
+            cdg_compact_get_row(&compact, 0, y, CDG_SCREEN_WIDTH, row);
+            ok = memcmp(expected, row, sizeof(row)) == 0;
+        }
+        // A part of a row, starting at an odd column
+        if (ok) {
+            int x = 1 + 2 * (int)(random_next(&seed) % (CDG_SCREEN_WIDTH / 2 - 1));
+            int w = 1 + (int)(random_next(&seed) % (CDG_SCREEN_WIDTH - x));
+            int y = random_next(&seed) % CDG_SCREEN_HEIGHT;
+            cdg_get_row(&full, x, y, w, expected);
+            cdg_compact_get_row(&compact, x, y, w, row);
+            ok = memcmp(expected, row, w) == 0;
+        }
+        ok = ok && memcmp(full.color_table, compact.color_table, sizeof(full.color_table)) == 0
+                && full.transparent_color == compact.transparent_color
+                && full.origin_x == compact.origin_x && full.origin_y == compact.origin_y
+                && full.offset_x == compact.offset_x && full.offset_y == compact.offset_y;
+        if (!ok) {
+            detail = "the compact state differs from the full one";
+            break;
+        }
+
+        cdg_init(&unpacked);
+        cdg_compact_unpack(&compact, &unpacked);
+        cdg_compact_pack(&full, &packed);
+        ok = same_state(&full, &unpacked);
+        for (int y = 0; y < CDG_SCREEN_HEIGHT && ok; y++) {
+            ok = memcmp(packed.pixels[y], compact.pixels[y], CDG_SCREEN_WIDTH / 2) == 0;
+        }
+        if (!ok) {
+            detail = "packing or unpacking does not give the same state";
+        }
+    }
+    report(name, ok, detail);
+}
+
+static void check_compact(const SubCode *song, size_t count)
+{
+    size_t random_count = (size_t)CDG_PACKETS_PER_SECOND * 100;
+    SubCode *subs = malloc(random_count * sizeof(SubCode));
+    if (subs == NULL) {
+        report("compact/random", 0, "out of memory");
+        return;
+    }
+    random_stream(subs, random_count, 29);
+    check_compact_stream("compact/random", subs, random_count, 31);
+    preset_stream(subs, random_count, 37);
+    check_compact_stream("compact/presets", subs, random_count, 41);
+    free(subs);
+
+    check_compact_stream("compact/song", song, count, 43);
+}
+
+// Writes one pixel in the given format, the plain way
+static void reference_pixel(CDG_RGB rgb, CDG_PixelFormat format, unsigned char *out)
+{
+    unsigned char r = rgb.red * 0x11;
+    unsigned char g = rgb.green * 0x11;
+    unsigned char b = rgb.blue * 0x11;
+    switch (format) {
+        case CDG_FORMAT_RGBA8888:
+            out[0] = r;
+            out[1] = g;
+            out[2] = b;
+            out[3] = 0xFF;
+            break;
+        case CDG_FORMAT_BGRA8888:
+            out[0] = b;
+            out[1] = g;
+            out[2] = r;
+            out[3] = 0xFF;
+            break;
+        case CDG_FORMAT_RGB565: {
+            uint16_t value = (uint16_t)((r >> 3) << 11 | (g >> 2) << 5 | (b >> 3));
+            memcpy(out, &value, sizeof(value));
+            break;
+        }
+        case CDG_FORMAT_RGB24:
+            out[0] = r;
+            out[1] = g;
+            out[2] = b;
+            break;
+    }
+}
+
+// Converts a rectangle of the screen one pixel at a time
+static void reference_convert(const cdg *cdg_state, const CDG_Rect *rect, CDG_PixelFormat format,
+                              unsigned char *dst, size_t stride)
+{
+    int bytes = cdg_format_bytes_per_pixel(format);
+    unsigned char row[CDG_SCREEN_WIDTH];
+    for (int y = rect->y; y < rect->y + rect->h; y++) {
+        cdg_get_row(cdg_state, 0, y, CDG_SCREEN_WIDTH, row);
+        for (int x = rect->x; x < rect->x + rect->w; x++) {
+            reference_pixel(cdg_state->color_table[row[x]], format, dst + y * stride + x * bytes);
+        }
+    }
+}
+
+/*
+ * Converting to every format matches a plain palette lookup per pixel, for
+ * whole screens, compact states, palettes and rectangles at any column, and
+ * leaves everything outside the rectangle alone. Built with -mssse3, this
+ * covers the byte shuffle paths.
+ */
+static void check_convert(void)
+{
+    enum { PACKETS = 6000, STRIDE = CDG_SCREEN_WIDTH * 4 + 13 };
+    static const CDG_PixelFormat formats[] = {
+        CDG_FORMAT_RGBA8888, CDG_FORMAT_BGRA8888, CDG_FORMAT_RGB565, CDG_FORMAT_RGB24
+    };
+    static SubCode subs[PACKETS];
+    static cdg state;
+    static CDG_Compact compact;
+    static unsigned char actual[CDG_SCREEN_HEIGHT][STRIDE];
+    static unsigned char expected[CDG_SCREEN_HEIGHT][STRIDE];
+    random_stream(subs, PACKETS, 47);
+
+    unsigned int seed = 53;
+    int ok = 1;
+    cdg_init(&state);
+    for (size_t done = 0; done < PACKETS && ok; done += PACKETS / 12) {
+        cdg_decode_range(subs + done, PACKETS / 12, &state);
+        cdg_compact_pack(&state, &compact);
+
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]) && ok; f++) {
+            CDG_Rect screen = { 0, 0, CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT };
+            memset(actual, 0xA5, sizeof(actual));
+            memset(expected, 0xA5, sizeof(expected));
+            reference_convert(&state, &screen, formats[f], expected[0], STRIDE);
+            ok = cdg_convert(&state, formats[f], actual, STRIDE) == 0
+              && memcmp(actual, expected, sizeof(actual)) == 0;
+
+            memset(actual, 0xA5, sizeof(actual));
+            ok = ok && cdg_compact_convert(&compact, formats[f], actual, STRIDE) == 0
+                    && memcmp(actual, expected, sizeof(actual)) == 0;
+
+            unsigned char palette[16 * 4];
+            unsigned char pixel[4];
+            ok = ok && cdg_convert_palette(&state, formats[f], palette) == 0;
+            int bytes = cdg_format_bytes_per_pixel(formats[f]);
+            for (int i = 0; i < 16 && ok; i++) {
+                reference_pixel(state.color_table[i], formats[f], pixel);
+                ok = memcmp(palette + i * bytes, pixel, bytes) == 0;
+            }
+
+            // Rectangles starting and ending anywhere, so that the 16 pixel
+            // steps meet every kind of leftover
+            for (int i = 0; i < 16 && ok; i++) {
+                CDG_Rect rect;
+                rect.x = random_next(&seed) % CDG_SCREEN_WIDTH;
+                rect.y = random_next(&seed) % CDG_SCREEN_HEIGHT;
+                rect.w = 1 + random_next(&seed) % (CDG_SCREEN_WIDTH - rect.x);
+                rect.h = 1 + random_next(&seed) % (CDG_SCREEN_HEIGHT - rect.y);
+                memset(actual, 0xA5, sizeof(actual));
+                memset(expected, 0xA5, sizeof(expected));
+                reference_convert(&state, &rect, formats[f], expected[0], STRIDE);
+                ok = cdg_convert_rect(&state, &rect, formats[f], actual, STRIDE) == 0
+                  && memcmp(actual, expected, sizeof(actual)) == 0;
+            }
+        }
+    }
+    report("convert/reference", ok, "converted pixels differ from a plain palette lookup");
+}
+
+int main(void)
+{
+    size_t count = (size_t)SONG_SECONDS * CDG_PACKETS_PER_SECOND;
+    SubCode *song = malloc(count * sizeof(SubCode));
+    if (song == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    synth_song(song, count, 1);
+
+#ifdef __SSSE3__
+    printf("Checking with the SSSE3 paths\n");
+#else
+    printf("Checking with the scalar paths\n");
+#endif
+    check_tiles();
+    check_timeline_high_bit();
+    check_timeline(song, count);
+    check_index(song, count);
+    check_encoder(song, count);
+    check_stream(song, count);
+    check_pack(song, count);
+    check_fast_forward(song, count);
+    check_segments(song, count);
+    check_composite();
+    check_compact(song, count);
+    check_convert();
+
+    free(song);
+    return failures > 0 ? 1 : 0;
+}
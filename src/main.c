@@ -20,76 +20,187 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdatomic.h>
 
 #include <SDL/SDL.h>
 #include "cdg.h"
+#include "cdg_file.h"
+#include "cdg_convert.h"
+#include "cdg_player.h"
+#include "cdg_triple.h"
+
+// How often to draw the screen
+#define REFRESH_RATE 60
+#define MSECS_PER_REFRESH (1000 / REFRESH_RATE)
+
+// How often the decoder catches up with the clock, once per sector
+#define MSECS_PER_DECODE (1000 / CDG_SECTORS_PER_SECOND)
+
+/*
+ * Packets are applied on a thread of their own, so that a slow flip or a
+ * wait for vsync on the render side never holds up decoding.
+ */
+typedef struct {
+    CDG_Player player;
+    CDG_Triple frames;
+    Uint32 start;
+    atomic_int stop;     // Set by the renderer to end the decoder early
+    atomic_int finished; // Set by the decoder once it is done
+    int status;          // 0 on success, 1 if processing a packet failed
+} decoder;
+
+static int screen_changed(const cdg *cdg_state)
+{
+    if (cdg_state->palette_dirty) {
+        return 1;
+    }
+    for (int i = 0; i < CDG_TILES_Y; i++) {
+        if (cdg_state->dirty[i] != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int decoder_main(void *arg)
+{
+    decoder *d = arg;
+    cdg *cdg_state = d->player.cdg_state;
+
+    while (!atomic_load(&d->stop) && !cdg_player_finished(&d->player)) {
+        Uint32 tick = SDL_GetTicks();
+        uint64_t usecs = (uint64_t)(tick - d->start) * 1000;
+
+        if (cdg_player_update(&d->player, usecs) != 0) {
+            d->status = 1;
+            break;
+        }
+
+        // Only hand over frames that differ from the last one
+        if (screen_changed(cdg_state)) {
+            cdg_triple_publish(&d->frames, cdg_state, usecs);
+            cdg_dirty_clear(cdg_state);
+        }
+
+        Uint32 elapsed = SDL_GetTicks() - tick;
+        if (elapsed < MSECS_PER_DECODE) {
+            SDL_Delay(MSECS_PER_DECODE - elapsed);
+        }
+    }
+
+    atomic_store(&d->finished, 1);
+    return d->status;
+}
 
 int cdg_read_file(char *filename)
 {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+    CDG_File file;
+    if (cdg_file_open(&file, filename) != 0) {
         fprintf(stderr, "Error while opening file: %s\n", strerror(errno));
         exit(2);
     }
 
-    SubCode subcode;
+    // Too large for the stack with its three frames
+    decoder *d = malloc(sizeof(decoder));
+    if (d == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        cdg_file_close(&file);
+        return 1;
+    }
+
     cdg cdg_state;
+    cdg_init(&cdg_state);
+
+    // The SDL surface to write to. It holds color indices, so that palette
+    // animations only need the 16 colors set again.
+    SDL_Surface* screen = SDL_SetVideoMode(CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT, 8,
+                                           SDL_SWSURFACE | SDL_HWPALETTE);
+
+    cdg_player_init(&d->player, &cdg_state, file.packets, file.count);
+    cdg_triple_init(&d->frames);
+    atomic_init(&d->stop, 0);
+    atomic_init(&d->finished, 0);
+    d->status = 0;
+    d->start = SDL_GetTicks();
+
+    SDL_Thread *thread = SDL_CreateThread(decoder_main, d);
+    if (thread == NULL) {
+        fprintf(stderr, "Could not start decoding: %s\n", SDL_GetError());
+        free(d);
+        cdg_file_close(&file);
+        return 1;
+    }
 
-    // The SDL surface to write to
-    SDL_Surface* screen = SDL_SetVideoMode(CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT, 32, SDL_SWSURFACE);
+    // Draw once per display refresh, with whatever frame was published last
+    int result = 0;
+    int running = 1;
+    uint64_t shown = 0;
+    while (running) {
+        Uint32 frame_start = SDL_GetTicks();
+
+        // Checked before taking the frame, so the last one is always drawn
+        int finished = atomic_load(&d->finished);
+
+        CDG_TripleFrame *frame;
+        if (cdg_triple_acquire(&d->frames, &frame)) {
+            // A frame holds the changes since the one published before it.
+            // If that one was missed, redraw everything.
+            if (frame->sequence != shown + 1) {
+                cdg_dirty_all(&frame->cdg_state);
+            }
+            shown = frame->sequence;
+
+            int palette_changed;
+            SDL_LockSurface(screen);
+            int changed = cdg_convert_indexed_dirty(&frame->cdg_state, screen->pixels, screen->pitch,
+                                                    &palette_changed);
+            SDL_UnlockSurface(screen);
+
+            if (palette_changed) {
+                // SDL_Color has the same layout as RGBA8888
+                SDL_Color colors[16];
+                cdg_convert_palette(&frame->cdg_state, CDG_FORMAT_RGBA8888, colors);
+                SDL_SetColors(screen, colors, 0, 16);
+            }
 
-    // While file has not ended
-    int p = 0;
-    while (fread(&subcode, sizeof(SubCode), 1, file)) {
-        CDG_Packet packet = cdg_parse_packet(&subcode);
-        if(cdg_process_packet(&packet, &cdg_state) != 0) {
-            printf("Something went wrong\n");
-            return 1;
-        }
-        // Free the packet
-        cdg_packet_put(&packet);
-
-        SDL_LockSurface(screen);
-        // Set the pixels in the SDL surface
-        for (int i = 0; i < CDG_SCREEN_WIDTH; i++) {
-            for (int j = 0; j < CDG_SCREEN_HEIGHT; j++) {
-                unsigned char color_index = cdg_state.pixels[i][j];
-                CDG_RGB color = cdg_state.color_table[color_index];
-
-                // R-G-B-A. 
-                Uint32 sdl_color = (((Uint32)color.red) << 24)
-                                 | (((Uint32)color.green) << 16)
-                                 | (((Uint32)color.blue << 8));
-
-                sdl_color *= 2;
-                /*
-                int offset = i * CDG_SCREEN_WIDTH + j;
-                Uint32 target_pixel = screen->pixels + offset
-                screen->pixels[offset] = 
-                */ 
+            //Update the screen
+            if ((changed || palette_changed) && SDL_Flip(screen) == -1) {
+                result = 1;
+                running = 0;
             }
         }
-        SDL_UnlockSurface(screen);
-        printf("Handled packet %i\n", p++);
 
-        //Update the screen
-        if( SDL_Flip( screen ) == -1 ) { 
-            return 1;
+        if (finished) {
+            running = 0;
         }
 
-        // 10x speed
-        // SDL_Delay(CDG_MSECS_PER_PACKET / 10);
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                running = 0;
+            }
+        }
+
+        // Wait for the next refresh
+        Uint32 elapsed = SDL_GetTicks() - frame_start;
+        if (running && elapsed < MSECS_PER_REFRESH) {
+            SDL_Delay(MSECS_PER_REFRESH - elapsed);
+        }
     }
 
-    // Sanity check and close the file
-    if (!feof(file) || ferror(file)) {
-        fprintf(stderr, "Reading of file failed\n");
-        return 2;
+    atomic_store(&d->stop, 1);
+    int status;
+    SDL_WaitThread(thread, &status);
+    if (status != 0) {
+        printf("Something went wrong\n");
+        result = 1;
     }
-    fclose(file);
+
+    free(d);
+    cdg_file_close(&file);
     // Done doing file stuff
 
-    return 0;
+    return result;
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Converts between .cdg files and the compact container of cdg_pack.h.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h> // SIZE_MAX
+#include <unistd.h> // getopt
+
+#include "cdg.h"
+#include "cdg_file.h"
+#include "cdg_pack.h"
+
+// Parses a whole, non-negative decimal number
+static int parse_number(const char *text, unsigned long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtoul(text, &end, 10);
+    return end == text || *end != '\0' || *text == '-' || errno != 0;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-i seconds] <cdg-file> <pack-file>\n", program);
+    fprintf(stderr, "       %s -d <pack-file> <cdg-file>\n", program);
+    fprintf(stderr, "  -i  Seconds between seek index entries, 0 for none (default 10)\n");
+    fprintf(stderr, "  -d  Unpack a pack into a .cdg file\n");
+    exit(1);
+}
+
+static int pack(const char *input, const char *output, size_t interval)
+{
+    CDG_File file;
+    if (cdg_file_open(&file, input) != 0) {
+        fprintf(stderr, "Error while opening file: %s\n", strerror(errno));
+        return 2;
+    }
+
+    if (cdg_pack_save(file.packets, file.count, interval, output) != 0) {
+        fprintf(stderr, "Error while writing pack: %s\n", strerror(errno));
+        cdg_file_close(&file);
+        return 2;
+    }
+
+    CDG_Pack packed;
+    if (cdg_pack_open(&packed, output) == 0) {
+        fprintf(stderr, "%zu packets, %zu with data: %zu bytes packed into %zu\n",
+                packed.count, packed.live, file.map_size, packed.file.map_size);
+        cdg_pack_close(&packed);
+    }
+    cdg_file_close(&file);
+    return 0;
+}
+
+static int unpack(const char *input, const char *output)
+{
+    CDG_Pack packed;
+    if (cdg_pack_open(&packed, input) != 0) {
+        fprintf(stderr, "Error while opening pack: %s\n", strerror(errno));
+        return 2;
+    }
+
+    // One extra byte, so that an empty pack is not mistaken for no memory
+    SubCode *subs = packed.count < SIZE_MAX / sizeof(SubCode)
+                  ? malloc(packed.count * sizeof(SubCode) + 1) : NULL;
+    if (subs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        cdg_pack_close(&packed);
+        return 2;
+    }
+    cdg_pack_unpack(&packed, subs);
+
+    int result = 0;
+    FILE *file = fopen(output, "wb");
+    if (file == NULL || fwrite(subs, sizeof(SubCode), packed.count, file) != packed.count
+            || fclose(file) != 0) {
+        fprintf(stderr, "Error while writing file: %s\n", strerror(errno));
+        result = 2;
+    }
+
+    free(subs);
+    cdg_pack_close(&packed);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long seconds = 10;
+    int unpacking = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:d")) != -1) {
+        switch (opt) {
+            case 'i':
+                if (parse_number(optarg, &seconds) != 0
+                    || seconds > SIZE_MAX / CDG_PACKETS_PER_SECOND) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'd':
+                unpacking = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+    }
+
+    if (unpacking) {
+        return unpack(argv[optind], argv[optind + 1]);
+    }
+    return pack(argv[optind], argv[optind + 1], seconds * CDG_PACKETS_PER_SECOND);
+}
@@ -0,0 +1,537 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Headless renderer. Decodes a .cdg file and writes the screen as raw video
+ * at a fixed frame rate, for piping into a video encoder.
+ *
+ * Long files can be rendered on several threads. The file is split where the
+ * screen is cleared, see cdg_segment.h, and every segment renders its frames
+ * to a temporary file of its own. The main thread copies those to the output
+ * in order, so the output is the same as when rendering on one thread.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h> // LONG_MAX, ULLONG_MAX
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h> // getopt
+
+#include "cdg.h"
+#include "cdg_file.h"
+#include "cdg_convert.h"
+#include "cdg_forward.h"
+#include "cdg_segment.h"
+#include "cdg_stats.h"
+
+// Segments to aim for per thread, so that threads finishing early have more
+// to take
+#define SEGMENTS_PER_THREAD 4
+
+// Largest numerator or denominator accepted for the frame rate
+#define MAX_RATE_PART 1000000UL
+
+typedef enum {
+    OUTPUT_Y4M, // YUV4MPEG2, 4:2:0
+    OUTPUT_PPM, // One binary PPM image per frame
+    OUTPUT_RGB  // Raw RGB24 frames
+} output_t;
+
+/*
+ * The frame in the chosen output format, updated only where the screen
+ * changed since the last frame
+ */
+typedef struct {
+    output_t type;
+    unsigned char rgb[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH * 3];
+    unsigned char y[CDG_SCREEN_HEIGHT][CDG_SCREEN_WIDTH];
+    unsigned char u[CDG_SCREEN_HEIGHT / 2][CDG_SCREEN_WIDTH / 2];
+    unsigned char v[CDG_SCREEN_HEIGHT / 2][CDG_SCREEN_WIDTH / 2];
+} frame;
+
+/*
+ * Frame k is shown at k * rate_den / rate_num seconds, and shows every
+ * packet that starts before that. Counting in packets keeps this exact
+ * for fractional rates: packets = ceil(k * den * 300 / num).
+ */
+typedef struct {
+    unsigned long long rate_num;
+    unsigned long long packets_per_frame_num; // rate_den * 300
+    size_t count;                             // Packets in the file
+    unsigned long long frames;                // The last frame
+} frame_clock;
+
+// Where rendering one segment of the file stopped
+typedef enum {
+    RENDER_OK,
+    RENDER_DECODE_FAILED,
+    RENDER_WRITE_FAILED
+} render_status;
+
+// The frames of one segment, rendered by whichever thread takes it
+typedef struct {
+    unsigned long long first_frame;
+    unsigned long long end_frame;
+    FILE *output;         // A temporary file
+    render_status status;
+    int done;             // Guarded by the lock of the renderer
+} job;
+
+typedef struct {
+    const CDG_File *file;
+    const CDG_Segments *segments;
+    const frame_clock *clock;
+    output_t type;
+    int stats;            // Whether to count packets
+    job *jobs;
+    atomic_size_t next;   // The next segment to take
+    atomic_int stop;      // Set once the output is not needed anymore
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} renderer;
+
+typedef struct {
+    renderer *renderer;
+    cdg cdg_state;
+    frame out;
+    CDG_Stats stats;
+} worker;
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-r fps] [-f y4m|ppm|rgb] [-o output] [-s stats] [-j threads] <cdg-file>\n",
+            program);
+    fprintf(stderr, "  -r  Frame rate, as an integer or a fraction like 30000/1001 (default 30)\n");
+    fprintf(stderr, "  -f  Output format (default y4m)\n");
+    fprintf(stderr, "  -o  Output file (default stdout)\n");
+    fprintf(stderr, "  -s  File to write decoder statistics to as JSON, - for stderr.\n");
+    fprintf(stderr, "      Needs a build with -DCDG_STATS=1\n");
+    fprintf(stderr, "  -j  Number of threads to render with (default 1)\n");
+    exit(1);
+}
+
+// Parses a whole, non-negative decimal number, and returns where it ended
+static int parse_number(const char *text, unsigned long *value, char **end)
+{
+    errno = 0;
+    *value = strtoul(text, end, 10);
+    return *end == text || *text == '-' || errno != 0;
+}
+
+/*
+ * Parses a frame rate such as "25" or "30000/1001". Both parts are at most
+ * MAX_RATE_PART, which keeps the frame clock arithmetic within 64 bits.
+ */
+static int parse_rate(const char *text, unsigned long *num, unsigned long *den)
+{
+    char *end;
+    if (parse_number(text, num, &end) != 0) {
+        return 1;
+    }
+    *den = 1;
+    if (*end == '/' && parse_number(end + 1, den, &end) != 0) {
+        return 1;
+    }
+    return *end != '\0' || *num == 0 || *den == 0 || *num > MAX_RATE_PART || *den > MAX_RATE_PART;
+}
+
+/*
+ * Converts the dirty parts of the screen to 4:2:0 BT.601 YUV. The colors are
+ * converted once per palette entry, and the dirty rectangles are made up of
+ * whole tiles, so they never split a 2x2 chroma block.
+ */
+static void update_yuv(cdg *cdg_state, frame *out)
+{
+    int y_table[16];
+    int u_table[16];
+    int v_table[16];
+    for (int i = 0; i < 16; i++) {
+        int r = cdg_state->color_table[i].red * 0x11;
+        int g = cdg_state->color_table[i].green * 0x11;
+        int b = cdg_state->color_table[i].blue * 0x11;
+        y_table[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        u_table[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v_table[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+
+    CDG_Rect rect;
+    while (cdg_dirty_next(cdg_state, &rect)) {
+        for (int y = rect.y; y < rect.y + rect.h; y += 2) {
+            unsigned char row0[CDG_SCREEN_WIDTH];
+            unsigned char row1[CDG_SCREEN_WIDTH];
+            cdg_get_row(cdg_state, rect.x, y, rect.w, row0);
+            cdg_get_row(cdg_state, rect.x, y + 1, rect.w, row1);
+
+            for (int x = rect.x; x < rect.x + rect.w; x += 2) {
+                int a = row0[x - rect.x] & 0x0F;
+                int b = row0[x - rect.x + 1] & 0x0F;
+                int c = row1[x - rect.x] & 0x0F;
+                int d = row1[x - rect.x + 1] & 0x0F;
+
+                out->y[y][x] = y_table[a];
+                out->y[y][x + 1] = y_table[b];
+                out->y[y + 1][x] = y_table[c];
+                out->y[y + 1][x + 1] = y_table[d];
+                out->u[y / 2][x / 2] = (u_table[a] + u_table[b] + u_table[c] + u_table[d] + 2) / 4;
+                out->v[y / 2][x / 2] = (v_table[a] + v_table[b] + v_table[c] + v_table[d] + 2) / 4;
+            }
+        }
+    }
+}
+
+static int write_frame(cdg *cdg_state, frame *out, FILE *output)
+{
+    switch (out->type) {
+        case OUTPUT_Y4M:
+            update_yuv(cdg_state, out);
+            fputs("FRAME\n", output);
+            fwrite(out->y, sizeof(out->y), 1, output);
+            fwrite(out->u, sizeof(out->u), 1, output);
+            fwrite(out->v, sizeof(out->v), 1, output);
+            break;
+        case OUTPUT_PPM:
+            fprintf(output, "P6\n%d %d\n255\n", CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT);
+            // Fall through
+        case OUTPUT_RGB:
+            cdg_convert_dirty(cdg_state, CDG_FORMAT_RGB24, out->rgb, sizeof(out->rgb[0]));
+            fwrite(out->rgb, sizeof(out->rgb), 1, output);
+            break;
+    }
+
+    return ferror(output) ? 1 : 0;
+}
+
+// The number of packets shown by frame k
+static size_t frame_packets(const frame_clock *clock, unsigned long long k)
+{
+    unsigned long long due = (k * clock->packets_per_frame_num + clock->rate_num - 1) / clock->rate_num;
+    return due < clock->count ? (size_t)due : clock->count;
+}
+
+/*
+ * Renders the frames from first up to but not including end. The state must
+ * have the packets before done applied, and done must not be past what the
+ * first frame shows.
+ */
+static render_status render_frames(const CDG_File *file, const frame_clock *clock, size_t done,
+                                   unsigned long long first, unsigned long long end,
+                            cdg *cdg_state, frame *out, FILE *output)
+{
+    for (unsigned long long k = first; k < end; k++) {
+        size_t target = frame_packets(clock, k);
+
+        if (cdg_fast_forward(file->packets + done, target - done, cdg_state) != target - done) {
+            return RENDER_DECODE_FAILED;
+        }
+        done = target;
+
+        if (write_frame(cdg_state, out, output) != 0) {
+            return RENDER_WRITE_FAILED;
+        }
+    }
+    return RENDER_OK;
+}
+
+static void *worker_main(void *arg)
+{
+    worker *w = arg;
+    renderer *r = w->renderer;
+    w->out.type = r->type;
+    cdg_stats_init(&w->stats);
+
+    size_t i;
+    while ((i = atomic_fetch_add(&r->next, 1)) < r->segments->count) {
+        job *j = &r->jobs[i];
+        const CDG_Segment *segment = &r->segments->segments[i];
+
+        if (!atomic_load(&r->stop)) {
+            j->output = tmpfile();
+        }
+        if (j->output == NULL) {
+            j->status = RENDER_WRITE_FAILED;
+        } else {
+            cdg_segment_start(segment, &w->cdg_state);
+            w->cdg_state.stats = r->stats ? &w->stats : NULL;
+            j->status = render_frames(r->file, r->clock, segment->begin, j->first_frame,
+                                      j->end_frame, &w->cdg_state, &w->out, j->output);
+        }
+
+        pthread_mutex_lock(&r->lock);
+        j->done = 1;
+        pthread_cond_broadcast(&r->finished);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+// Appends the whole of a temporary file to the output
+static int copy_output(FILE *from, FILE *to)
+{
+    if (fflush(from) != 0 || fseek(from, 0, SEEK_SET) != 0) {
+        return 1;
+    }
+
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        if (fwrite(buffer, 1, n, to) != n) {
+            return 1;
+        }
+    }
+    return ferror(from) ? 1 : 0;
+}
+
+/*
+ * Renders every frame on the given number of threads, and adds up their
+ * statistics in stats if it is not NULL. Returns RENDER_OK, the status of the
+ * first segment that failed, or RENDER_WRITE_FAILED if setting up failed.
+ */
+static render_status render_parallel(const CDG_File *file, const frame_clock *clock, output_t type,
+                                     long threads, CDG_Stats *stats, FILE *output)
+{
+    CDG_Segments segments;
+    size_t min_length = file->count / (threads * SEGMENTS_PER_THREAD);
+    if (cdg_segments_find(&segments, file->packets, file->count, min_length) != 0) {
+        return RENDER_WRITE_FAILED;
+    }
+
+    renderer r;
+    r.file = file;
+    r.segments = &segments;
+    r.clock = clock;
+    r.type = type;
+    r.stats = stats != NULL;
+    r.jobs = calloc(segments.count, sizeof(job));
+    atomic_init(&r.next, 0);
+    atomic_init(&r.stop, 0);
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.finished, NULL);
+
+    // Each frame goes to the segment holding the last packet it shows
+    if (r.jobs != NULL) {
+        size_t i = 0;
+        for (unsigned long long k = 0; k <= clock->frames; k++) {
+            size_t target = frame_packets(clock, k);
+            while (i + 1 < segments.count && target >= segments.segments[i + 1].begin) {
+                r.jobs[++i].first_frame = k;
+            }
+            r.jobs[i].end_frame = k + 1;
+        }
+        // Segments with no frames of their own end where they begin
+        for (i = 1; i < segments.count; i++) {
+            if (r.jobs[i].end_frame < r.jobs[i].first_frame) {
+                r.jobs[i].first_frame = r.jobs[i - 1].end_frame;
+                r.jobs[i].end_frame = r.jobs[i].first_frame;
+            }
+        }
+    }
+
+    if ((size_t)threads > segments.count) {
+        threads = segments.count;
+    }
+    worker *workers = calloc(threads, sizeof(worker));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    long started = 0;
+    if (r.jobs != NULL && workers != NULL && ids != NULL) {
+        for (; started < threads; started++) {
+            workers[started].renderer = &r;
+            if (pthread_create(&ids[started], NULL, worker_main, &workers[started]) != 0) {
+                break;
+            }
+        }
+    }
+
+    // Copy the segments out in order as they finish. Once one fails, the
+    // rest are still waited for, but not rendered.
+    render_status result = started == 0 ? RENDER_WRITE_FAILED : RENDER_OK;
+    for (size_t i = 0; i < segments.count && started > 0; i++) {
+        job *j = &r.jobs[i];
+        pthread_mutex_lock(&r.lock);
+        while (!j->done) {
+            pthread_cond_wait(&r.finished, &r.lock);
+        }
+        pthread_mutex_unlock(&r.lock);
+
+        // What was rendered before a failure is written out, as it would be
+        // on one thread
+        if (result == RENDER_OK && j->output != NULL && copy_output(j->output, output) != 0) {
+            j->status = RENDER_WRITE_FAILED;
+        }
+        if (result == RENDER_OK && j->status != RENDER_OK) {
+            result = j->status;
+            atomic_store(&r.stop, 1);
+        }
+        if (j->output != NULL) {
+            fclose(j->output);
+        }
+    }
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+        if (stats != NULL) {
+            cdg_stats_add(stats, &workers[i].stats);
+        }
+    }
+
+    pthread_cond_destroy(&r.finished);
+    pthread_mutex_destroy(&r.lock);
+    free(ids);
+    free(workers);
+    free(r.jobs);
+    cdg_segments_free(&segments);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long rate_num = 30;
+    unsigned long rate_den = 1;
+    output_t type = OUTPUT_Y4M;
+    const char *output_name = NULL;
+    const char *stats_name = NULL;
+    long threads = 1;
+    unsigned long number;
+    char *end;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:f:o:s:j:")) != -1) {
+        switch (opt) {
+            case 'r':
+                if (parse_rate(optarg, &rate_num, &rate_den) != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "y4m") == 0) {
+                    type = OUTPUT_Y4M;
+                } else if (strcmp(optarg, "ppm") == 0) {
+                    type = OUTPUT_PPM;
+                } else if (strcmp(optarg, "rgb") == 0) {
+                    type = OUTPUT_RGB;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case 'o':
+                output_name = optarg;
+                break;
+            case 's':
+                if (!CDG_STATS) {
+                    fprintf(stderr, "Built without statistics, rebuild with -DCDG_STATS=1\n");
+                    exit(1);
+                }
+                stats_name = optarg;
+                break;
+            case 'j':
+                if (parse_number(optarg, &number, &end) != 0 || *end != '\0'
+                    || number < 1 || number > LONG_MAX) {
+                    usage(argv[0]);
+                }
+                threads = number;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    CDG_File file;
+    if (cdg_file_open(&file, argv[optind]) != 0) {
+        fprintf(stderr, "Error while opening file: %s\n", strerror(errno));
+        exit(2);
+    }
+
+    FILE *output = stdout;
+    if (output_name != NULL) {
+        output = fopen(output_name, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "Error while opening output: %s\n", strerror(errno));
+            exit(2);
+        }
+    }
+
+    // Static, since it is too large to comfortably keep on the stack
+    static cdg cdg_state;
+    static frame out;
+    static CDG_Stats stats;
+    cdg_init(&cdg_state);
+    out.type = type;
+    if (stats_name != NULL) {
+        cdg_stats_init(&stats);
+        cdg_state.stats = &stats;
+    }
+
+    if (type == OUTPUT_Y4M) {
+        fprintf(output, "YUV4MPEG2 W%d H%d F%lu:%lu Ip A1:1 C420jpeg\n",
+                CDG_SCREEN_WIDTH, CDG_SCREEN_HEIGHT, rate_num, rate_den);
+    }
+
+    frame_clock clock;
+    clock.rate_num = rate_num;
+    clock.packets_per_frame_num = (unsigned long long)rate_den * CDG_PACKETS_PER_SECOND;
+    clock.count = file.count;
+
+    // Frame times are counted in packets times the rate, one frame past the end
+    if (file.count > (ULLONG_MAX - 2 * clock.packets_per_frame_num) / clock.rate_num) {
+        fprintf(stderr, "File too long for the frame rate\n");
+        exit(2);
+    }
+    clock.frames = (file.count * clock.rate_num + clock.packets_per_frame_num - 1)
+                 / clock.packets_per_frame_num;
+
+    render_status status;
+    if (threads > 1) {
+        status = render_parallel(&file, &clock, type, threads,
+                                 stats_name != NULL ? &stats : NULL, output);
+    } else {
+        status = render_frames(&file, &clock, 0, 0, clock.frames + 1, &cdg_state, &out, output);
+    }
+
+    int result = 0;
+    if (status == RENDER_DECODE_FAILED) {
+        fprintf(stderr, "Decoding failed\n");
+        result = 1;
+    } else if (status == RENDER_WRITE_FAILED) {
+        fprintf(stderr, "Writing output failed: %s\n", strerror(errno));
+        result = 2;
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    cdg_file_close(&file);
+
+    if (stats_name != NULL) {
+        FILE *stats_file = strcmp(stats_name, "-") == 0 ? stderr : fopen(stats_name, "w");
+        if (stats_file == NULL || cdg_stats_write_json(&stats, stats_file) != 0) {
+            fprintf(stderr, "Writing statistics failed: %s\n", strerror(errno));
+            result = 2;
+        }
+        if (stats_file != NULL && stats_file != stderr) {
+            fclose(stats_file);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "synth.h"
+
+#include <string.h> // memset
+
+// A new page of lyrics this often
+#define PAGE_PACKETS (12 * CDG_PACKETS_PER_SECOND)
+// Lines of lyrics per page, and how wide they are at most in tiles
+#define PAGE_LINES 4
+#define LINE_TILES 44
+
+typedef struct {
+    SubCode *packets;
+    size_t count;
+    unsigned int random;
+} synth;
+
+// A small linear congruential generator, so output does not depend on libc
+static unsigned int next_random(synth *s, unsigned int range)
+{
+    s->random = s->random * 1103515245u + 12345u;
+    return ((s->random >> 16) & 0x7FFF) % range;
+}
+
+// Writes a packet at or after the given position, wherever there is room
+static size_t put(synth *s, size_t position, unsigned char instruction, const unsigned char data[16])
+{
+    while (position < s->count && (s->packets[position].command & CDG_MASK) == CDG_COMMAND) {
+        position++;
+    }
+    if (position >= s->count) {
+        return position;
+    }
+
+    SubCode *sub = &s->packets[position];
+    sub->command = CDG_COMMAND;
+    sub->instruction = instruction;
+    memcpy(sub->data, data, sizeof(sub->data));
+    return position;
+}
+
+static void put_colors(synth *s, size_t position, unsigned char instruction)
+{
+    unsigned char data[16];
+    for (int i = 0; i < 16; i++) {
+        data[i] = next_random(s, 64);
+    }
+    put(s, position, instruction, data);
+}
+
+static void put_tile(synth *s, size_t position, unsigned char instruction,
+                     int row, int column, unsigned char color0, unsigned char color1)
+{
+    unsigned char data[16];
+    data[0] = color0;
+    data[1] = color1;
+    data[2] = row;
+    data[3] = column;
+    for (int i = 0; i < 12; i++) {
+        // Glyph-like rows, with the top and bottom rows mostly blank
+        data[4 + i] = (i < 2 || i > 9) ? 0 : next_random(s, 64);
+    }
+    put(s, position, instruction, data);
+}
+
+static void page(synth *s, size_t start)
+{
+    unsigned char data[16];
+    memset(data, 0, sizeof(data));
+
+    // Clear the screen. Real discs repeat the preset, numbering the repeats.
+    put_colors(s, start, CDG_LOAD_COLORS_LOW);
+    put_colors(s, start, CDG_LOAD_COLORS_HIGH);
+    for (int i = 0; i < 16; i++) {
+        data[0] = 1;
+        data[1] = i;
+        put(s, start + 2 + i, CDG_MEMORY_PRESET, data);
+    }
+    data[0] = 2;
+    data[1] = 0;
+    put(s, start + 18, CDG_BORDER_PRESET, data);
+
+    // Draw the lines over the first few seconds, two tile rows per line, in
+    // dense bursts of every other packet
+    size_t position = start + 20;
+    int widths[PAGE_LINES];
+    for (int line = 0; line < PAGE_LINES; line++) {
+        widths[line] = LINE_TILES / 2 + next_random(s, LINE_TILES / 2);
+        int first = (CDG_TILES_X - widths[line]) / 2;
+        for (int half = 0; half < 2; half++) {
+            for (int column = first; column < first + widths[line]; column++) {
+                put_tile(s, position, CDG_TILE_BLOCK, 3 + line * 3 + half, column, 1, 3);
+                position += 2;
+            }
+        }
+    }
+
+    // Then wipe each line in turn, spread over the rest of the page
+    size_t wipe_start = position;
+    size_t per_line = (start + PAGE_PACKETS - wipe_start) / PAGE_LINES;
+    for (int line = 0; line < PAGE_LINES; line++) {
+        int first = (CDG_TILES_X - widths[line]) / 2;
+        size_t step = per_line / (widths[line] + 1);
+        for (int column = first; column < first + widths[line]; column++) {
+            size_t at = wipe_start + line * per_line + (column - first) * step;
+            put_tile(s, at, CDG_TILE_BLOCK_XOR, 3 + line * 3, column, 0, 6);
+            put_tile(s, at + 1, CDG_TILE_BLOCK_XOR, 4 + line * 3, column, 0, 6);
+        }
+    }
+
+    // Some palette cycling, and now and then a scroll or a transparency change
+    for (size_t at = start + 3 * CDG_PACKETS_PER_SECOND; at < start + PAGE_PACKETS;
+            at += 3 * CDG_PACKETS_PER_SECOND) {
+        put_colors(s, at, CDG_LOAD_COLORS_HIGH);
+    }
+    if (next_random(s, 3) == 0) {
+        data[0] = next_random(s, 16);
+        data[1] = (next_random(s, 3) << 4) | next_random(s, 6);
+        data[2] = (next_random(s, 3) << 4) | next_random(s, 12);
+        put(s, start + PAGE_PACKETS - 40, next_random(s, 2) ? CDG_SCROLL_PRESET : CDG_SCROLL_COPY, data);
+    }
+    if (next_random(s, 4) == 0) {
+        data[0] = next_random(s, 16);
+        put(s, start + PAGE_PACKETS - 20, CDG_DEFINE_TRANSPARENT, data);
+    }
+}
+
+void synth_song(SubCode *packets, size_t count, unsigned int seed)
+{
+    synth s = { packets, count, seed };
+
+    // Everything that is not drawn on is an empty packet
+    memset(packets, 0, count * sizeof(SubCode));
+
+    for (size_t start = 0; start < count; start += PAGE_PACKETS) {
+        page(&s, start);
+    }
+}
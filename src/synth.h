@@ -0,0 +1,37 @@
+/*
+ * Copyright 2017 - Tobias Olausson
+ *
+ * This file is part of libcdg.
+ *
+ * libcdg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libcdg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcdg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Deterministic generator of synthetic .cdg streams, for benchmarks. The
+ * streams mimic a typical karaoke song: pages of lyrics drawn as bursts of
+ * tiles after a screen clear, highlight wipes done with XOR tiles, palette
+ * cycling, the odd scroll, and mostly empty packets in between.
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stddef.h> // size_t
+
+#include "cdg.h"
+
+// Fills count packets with a song. The same seed always gives the same song.
+void synth_song(SubCode *packets, size_t count, unsigned int seed);
+
+#endif // SYNTH_H